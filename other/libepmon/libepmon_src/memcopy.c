@@ -8,9 +8,32 @@ void *memcopy(void *s1, const void *s2, int n)
                 t += n;
                 while (n-- > 0)                
                         *--t = *--f;                   
-        } else
+        } else {
+                /* same word alignment: go four bytes at a time, unrolled */
+                if (n >= 16 && (((unsigned long)f ^ (unsigned long)t) & 3) == 0) {
+                        unsigned int *tw;
+                        const unsigned int *fw;
+
+                        while (((unsigned long)t & 3) != 0) {
+                                *t++ = *f++;
+                                n--;
+                        }
+                        tw = (unsigned int *)t;
+                        fw = (const unsigned int *)f;
+                        for (; n >= 16; n -= 16) {
+                                tw[0] = fw[0]; tw[1] = fw[1];
+                                tw[2] = fw[2]; tw[3] = fw[3];
+                                tw += 4;
+                                fw += 4;
+                        }
+                        for (; n >= 4; n -= 4)
+                                *tw++ = *fw++;
+                        t = (char *)tw;
+                        f = (const char *)fw;
+                }
                 while (n-- > 0)                
                         *t++ = *f++;                   
+        }
         return s1;
 }
 
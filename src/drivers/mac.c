@@ -27,6 +27,7 @@
 #include "mac.h"
 #include "regs.h"
 #include "irq.h"
+#include "trace.h"
 
 desc_t *send_desc_table_ptr;
 desc_t *recv_desc_table_ptr;
@@ -605,6 +606,7 @@ void check_irq_mac()
     {
         if((*(uint32_t*)INT1_SR)&(0x00000001<<3))
         {
+            TRACE(TRACE_CLASS_IRQ, TRACE_IRQ, 3, current_running->user_context.cp0_epc);
             irq_mac();
         }
         // printk("invalid interrupt:%x\n",status);
@@ -0,0 +1,42 @@
+#ifndef INCLUDE_BCACHE_H_
+#define INCLUDE_BCACHE_H_
+
+#include "type.h"
+
+/*
+ * write-back cache of FS blocks, between read_block()/write_block() in fs.c
+ * and the SD card. dirty blocks reach the card when they are evicted, on
+ * do_sync(), or when bflushd wakes up every BCACHE_FLUSH_INTERVAL seconds.
+ */
+#define BCACHE_BLOCKS 64            // 256KB of 4KB blocks
+#define BCACHE_HASH_SIZE 64         // power of two
+#define BCACHE_FLUSH_INTERVAL 5     // sys_sleep() units
+
+typedef struct buf {
+    uint32_t block;                 // FS block index
+    bool_t   valid;
+    bool_t   dirty;
+    uint8_t *data;
+    struct buf *hash_next;
+    struct buf *lru_prev;           // LRU list, most recently used first
+    struct buf *lru_next;
+} buf_t;
+
+/* 0: every block goes straight to the card (for benchmarking), flip it only after do_sync() */
+extern uint32_t bcache_enabled;
+
+extern int bcache_hit_count;
+extern int bcache_miss_count;
+extern int bcache_sd_read_count;   // card transfers, a run of file blocks counts once
+extern int bcache_sd_write_count;
+
+void bcache_init();
+void bcache_read(uint32_t block, uint8_t *dest);
+void bcache_write(uint32_t block, uint8_t *src);
+void bcache_read_run(uint32_t block, uint32_t n, uint8_t *dest);
+void bcache_write_run(uint32_t block, uint32_t n, uint8_t *src);
+void bcache_sync();
+void do_sync();
+void bflush_process();
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef INCLUDE_DCACHE_H_
+#define INCLUDE_DCACHE_H_
+
+#include "type.h"
+#include "fs.h"
+
+/*
+ * name lookup cache in front of the directory scan in find_file().
+ * (parent inum, name) -> inum, a miss (-1) is remembered as well.
+ * write_dentry() drops the names it overwrites, do_rmdir() everything
+ * under the inode it frees.
+ */
+#define DCACHE_ENTRIES 128
+#define DCACHE_HASH_SIZE 64         // power of two
+
+typedef struct dcache_entry {
+    bool_t   valid;
+    uint32_t parent;                // inum of the directory
+    int      inum;                  // -1: no such name
+    char     name[MAX_NAME_LENGTH];
+    struct dcache_entry *hash_next;
+} dcache_entry_t;
+
+extern int dcache_hit_count;
+extern int dcache_miss_count;
+
+void dcache_init();
+bool_t dcache_lookup(uint32_t parent, const char *name, int *inum);
+void dcache_insert(uint32_t parent, const char *name, int inum);
+void dcache_forget(uint32_t parent, const char *name);
+void dcache_forget_dir(uint32_t parent);
+
+#endif
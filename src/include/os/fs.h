@@ -99,6 +99,7 @@ enum {
     INODE_NUM_PER_BLOCK = BLOCK_SIZE / INODE_SIZE,
 
     MAX_DIRECT_NUM = 12,
+    INODE_EXTENT_NUM = 3,
 
     //SD INFO
 
@@ -112,6 +113,10 @@ enum {
     //file descriptor
     MAX_FILE_DESCRIPTOR_NUM = 32,
 
+    //block-map cache
+    BMAP_CACHE_NUM = 4,
+    BMAP_DEPTH = 3,
+
     POINTER_PER_BLOCK = (BLOCK_SIZE / sizeof(int32_t)),
     FIRST_POINTER = MAX_DIRECT_NUM,
     SECOND_POINTER = (FIRST_POINTER + POINTER_PER_BLOCK),
@@ -158,6 +163,12 @@ typedef struct superblock {
     //128
 } superblock_t; //size: 128*sizeof(int) -> 512Byte
 
+typedef struct extent {
+    uint32_t e_fblock;                       //第一个文件内block号
+    uint32_t e_block;                        //第一个磁盘block号
+    uint32_t e_len;                          //连续block数, 0为空
+} extent_t;
+
 typedef struct inode {
     uint16_t i_fmode;                        //文件类型和权限信息
     uint16_t i_links_cnt;                    //硬链接数量 
@@ -176,7 +187,9 @@ typedef struct inode {
     //21
     uint32_t i_num;                          //inode number
     //22
-    uint32_t padding[10];
+    extent_t i_extent[INODE_EXTENT_NUM];     //连续分配的区段, block指针的快速映射
+    //31
+    uint32_t padding[1];
     //32
 } inode_t;  //size: 32*sizeof(int) -> 128Byte
 
@@ -199,6 +212,14 @@ typedef struct file_descriptor {
     //8
 } file_descriptor_t; //size: 8*sizeof(int) -> 32Byte
 
+/* 一个inode最近走过的间接块路径, 顺序读写时不必每块都重读 */
+typedef struct bmap_cache {
+    uint32_t bc_inum;
+    uint32_t bc_used;                                   //LRU
+    uint32_t bc_block[BMAP_DEPTH];                      //各层缓存的指针块号, 0: 无
+    uint32_t bc_ptr[BMAP_DEPTH][POINTER_PER_BLOCK];
+} bmap_cache_t;
+
 typedef uint16_t mode_t;
 
 
@@ -257,6 +278,7 @@ void do_chmod(char *name);
 void separate_path(const char *path, char *parent, char *name);
 // void separate_path(char *path, char *parent, char *name);
 int get_block_index_in_inode(inode_t *inode_ptr, uint32_t idx);
+void get_block_range_in_inode(inode_t *inode_ptr, uint32_t begin, uint32_t n, uint32_t *blocks);
 void write_block_index_in_inode(inode_t *inode_ptr, uint32_t idx, uint32_t block_index);
 // int find_file(inode_t *inode_ptr, const char *name);
 int find_file(inode_t *inode_ptr, char *name);
@@ -68,6 +68,8 @@ void interrupt_helper(uint32_t, uint32_t);
 extern void exception_handler_entry(void);
 extern void exception_handler_begin(void);
 extern void exception_handler_end(void);
+extern void tlb_refill_handler_begin(void);
+extern void tlb_refill_handler_end(void);
 
 extern void handle_int(void);
 extern void handle_syscall(void);
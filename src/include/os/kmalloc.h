@@ -0,0 +1,30 @@
+#ifndef INCLUDE_KMALLOC_H_
+#define INCLUDE_KMALLOC_H_
+
+#include "type.h"
+
+/* power-of-two size classes: 16B .. 2KB, anything bigger takes whole frames */
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MAX_SHIFT 11
+#define KMALLOC_NUM_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+#define KMALLOC_MAX_SIZE (1 << KMALLOC_MAX_SHIFT)
+
+/* one entry per size class, the last one (index KMALLOC_NUM_CLASSES) counts multi-frame blocks */
+typedef struct kmalloc_stat {
+    uint32_t size;          // block size, 0 for the multi-frame entry
+    uint32_t pages;         // frames currently held
+    uint32_t in_use;        // blocks handed out
+    uint32_t free;          // blocks sitting on the free list
+    uint32_t alloc_count;
+    uint32_t free_count;
+    uint32_t fail_count;
+} kmalloc_stat_t;
+
+extern kmalloc_stat_t KmallocStat[KMALLOC_NUM_CLASSES + 1];
+
+void init_kmalloc();
+void *kmalloc(uint32_t size);
+void *kzalloc(uint32_t size);
+void kfree(void *ptr);
+
+#endif
@@ -4,13 +4,19 @@
 #include "type.h"
 #include "sched.h"
 
+/* size of the swap division on the SD card, override with -DSWAP_DIVISION_MB=n */
+#ifndef SWAP_DIVISION_MB
+#define SWAP_DIVISION_MB 32
+#endif
+
 enum {
     /* physical page facts */
     PAGE_SIZE = 0x1000, //4KB
 
-    PAGE_TABLE_SIZE = 0x200000, //16M - 18M => 512 PAGES => 2MB => 0 - 2G VM 
-    PAGE_TABLE_PAGES = (PAGE_TABLE_SIZE / PAGE_SIZE),
-    PAGE_TABLE_ENTRIES_NUM = (PAGE_TABLE_SIZE / sizeof(uint32_t)), 
+    /* two-level page table, one page per level */
+    PGDIR_SHIFT = 22,
+    PGDIR_ENTRIES_NUM = 1024,  //4MB per directory entry
+    PGTABLE_ENTRIES_NUM = 1024,
 
     // Global bit
     PTE_G = (0x40 >> 6),
@@ -31,7 +37,7 @@ enum {
     FRAME_PAGES = FRAME_SIZE / PAGE_SIZE,
     /*******************************************************/
     SD_SWAP_DIVISION_START = 0x2000000, //32M
-    SD_SWAP_DIVISION = 0x1000,
+    SD_SWAP_DIVISION = SWAP_DIVISION_MB << 20, //32MB => 8192 units
     SD_SWAP_UNIT = 0X1000,
     SD_SWAP_UNIT_NUM = SD_SWAP_DIVISION / SD_SWAP_UNIT,
     /*******************************************************/
@@ -68,13 +74,46 @@ enum {
     //page frame
     PAGE_FRAME_START = 0xa1000000, //16M
 
+    //swapd wakes under the low watermark and frees frames up to the high one
+    SWAP_LOW_WATERMARK = FRAME_PAGES / 16,
+    SWAP_HIGH_WATERMARK = FRAME_PAGES / 8,
+    SWAP_BATCH = 8, //pages staged per SD write
+    SWAP_READAHEAD = 4, //pages per swap-in SD read, the faulting one included
+
+    //user regions mapped with large TLB entries (64KB/1MB pages; 16MB ones do not fit in FRAME_SIZE)
+    VM_LARGE_MAX = 16,
+
     //tlb
     TLB_ENTRIES_NUM = 32, //0-31
+    TLB_WIRED_MAX = 8,    //slots 0-7 may be wired by vm_wire, the rest stay for tlbwr
+    ASID_MASK = 0xff,
 
 };
 
+#define PGDIR_INDEX(vaddr)   ((vaddr) >> PGDIR_SHIFT)
+#define PGTABLE_INDEX(vaddr) (((vaddr) >> 12) & (PGTABLE_ENTRIES_NUM - 1))
+
+/* 
+ * software bit of a non-valid PTE: the page is in swap and the low bits hold 
+ * its unit. a present PTE without PTE_V is mapped but not referenced since the 
+ * clock hand last passed, one without PTE_D has not been stored to.
+ */
+#define PTE_SWAPPED 0x80000000
+
 extern int tlb_refill_count;
 extern int tlb_invalid_count;
+/* 0: every refill takes the C path through handle_tlb (for benchmarking) */
+extern uint32_t tlb_refill_fast_enabled;
+
+extern int page_evict_count;
+extern int page_writeback_count;
+extern int page_swapin_count;
+extern int page_readahead_count;
+extern int page_direct_reclaim_count;
+extern int page_zero_map_count;
+extern int page_cow_count;
+extern int tlb_large_count;
+extern int swapd_reclaim_count;
 
 typedef struct page_map_entry {
     uint32_t paddr; 
@@ -89,8 +128,22 @@ typedef struct page_map_entry {
     bool_t   swaped;
     int      swap_index;
     bool_t   R;
+    int      share;     // PTEs mapping the frame, > 1 while copy-on-write shared
 } page_map_entry_t;
 
+typedef struct vm_large {
+    pid_t    pid;
+    uint32_t vaddr;
+    uint32_t size;       // 0: slot unused
+    uint32_t page_size;  // one half of a TLB entry
+} vm_large_t;
+
+typedef struct tlb_wired {
+    bool_t   used;
+    pid_t    pid;
+    uint32_t vaddr;      // even page of the pair
+} tlb_wired_t;
+
 typedef struct tlb_entry {
     uint32_t index;
     bool_t   empty;
@@ -110,6 +163,18 @@ typedef uint32_t page_table_entry_t;
 // extern page_table_entry_t page_table[PAGE_TABLE_ENTRIES];
 
 void init_memory();
+void init_page_map();
+void free_page_table(pcb_t *pcb);
+int vm_share_cow(pcb_t *dst, pcb_t *src);
+int vm_map_large(pcb_t *pcb, uint32_t vaddr, uint32_t size);
+void vm_release_range(pcb_t *pcb, uint32_t start, uint32_t end);
+int vm_large_split(pcb_t *pcb, uint32_t start, uint32_t end);
+uint32_t page_free_frames();
+int vm_wire(uint32_t vaddr);
+int vm_unwire(uint32_t vaddr);
+uint32_t kpage_alloc(int npages);
+void kpage_free(uint32_t vaddr, int npages);
+void swap_process();
 // void do_TLB_Refill();
 // void do_page_fault();
 
@@ -137,6 +202,7 @@ void sdwrite(unsigned char *buf, unsigned int base, int n);
 
 extern void tlb_flush(int EntryHi);
 extern void tlb_flush_no_check();
+extern void tlb_flush_asid(uint32_t asid);
 
 extern uint32_t get_cp0_status();
 extern void set_cp0_status(uint32_t cp0_status);
@@ -153,6 +219,8 @@ extern uint32_t get_cp0_entrylo1();
 extern void set_cp0_entrylo1(uint32_t cp0_entrylo1);
 extern uint32_t get_cp0_pagemask();
 extern void set_cp0_pagemask(uint32_t cp0_pagemask);
+extern uint32_t get_cp0_wired();
+extern void set_cp0_wired(uint32_t cp0_wired);
 
 //for debug
 extern uint32_t get_sp_reg();
@@ -53,6 +53,7 @@ void *queue_remove(queue_t *queue, void *item);
 
 void enqueue(queue_t *queue, void *item);
 
+/* ordered insert, see queue.c */
 void queue_sort(queue_t *queue, void *item, item_comp_t item_comp);
 
 int check_in_queue(queue_t *queue, void *item);
@@ -38,14 +38,26 @@
 #include "regs.h"
 #include "lock.h"
 
+/* size of the task table, may be overridden at build time (-DNUM_MAX_TASK=n) */
+#ifndef NUM_MAX_TASK
 #define NUM_MAX_TASK 40
+#endif
+/* a slot's ASID is its index + 1 in the 8-bit EntryHi field, 0 is the kernel */
+#if NUM_MAX_TASK > 255
+#error "NUM_MAX_TASK above 255 would alias TLB ASIDs"
+#endif
+/* buckets of the pid -> pcb hash, power of two */
+#define PID_HASH_SIZE 64
 
 #define MAX_PID 1024
 #define MAX_PRIORITY 5
 #define INITIAL_PRIORITY 4
+#define NUM_PRIORITY_LEVEL (MAX_PRIORITY + 1)
+/* every PRIORITY_BOOST_INTERVAL schedules, lift all ready tasks back to INITIAL_PRIORITY */
+#define PRIORITY_BOOST_INTERVAL 64
 
 #define STACK_MIN 0xa0f00000
-#define STACK_SIZE 0x80000
+#define STACK_SIZE 0x40000
 #define STACK_MAX 0xa2000000
 #define CP0_STATUS_INIT 0x10008000
 #define LOCK_MAX_NUM 10
@@ -140,7 +152,6 @@ typedef struct pcb
     int cursor_x;
     int cursor_y;
 
-    uint32_t wait_time;
     priority_t priority;
     
     mutex_lock_t *lock[LOCK_MAX_NUM];
@@ -148,9 +159,33 @@ typedef struct pcb
 
     queue_t waiting_queue;
 
-    uint32_t sleeping_deadline;
+    uint64_t sleeping_deadline; // in clock cycles
 
+    /* page directory, allocated on the first TLB fault (offset 424, read by the refill vector) */
     uint32_t page_table_base_addr;
+    /* EntryHi ASID: slot index + 1, 0 is the kernel */
+    uint32_t asid;
+
+    /* cpu accounting, in clock cycles */
+    uint64_t user_cycles;
+    uint64_t kernel_cycles;
+    uint64_t wait_cycles;   // ready but not running
+    uint64_t start_cycles;
+    uint64_t stamp_cycles;  // last time one of the above was charged
+    uint32_t switch_count;
+    uint32_t voluntary_switches;
+    uint32_t involuntary_switches;
+
+    /* next pcb in the same pid hash bucket */
+    struct pcb *hash_next;
+
+    /* mmap/brk areas sorted by start, checked on faults once the task used them */
+    struct vm_area *vma_list;
+    bool_t vma_enforced;
+    uint32_t brk;
+
+    /* queue the task was last blocked on (mutex, sem, cond, barrier, waitpid); valid while TASK_BLOCKED */
+    queue_t *blocked_queue;
 
 } pcb_t;
 
@@ -169,10 +204,30 @@ typedef struct process_show {
     task_status_t status;
 } process_show_t;
 
-extern process_show_t ProcessShow[40];
+/* filled by do_ps: the running task, every other live slot, num == -1 */
+extern process_show_t ProcessShow[NUM_MAX_TASK + 2];
 
-/* ready queue to run */
-extern queue_t ready_queue;
+typedef struct task_stat {
+    int num;
+    int pid;
+    task_status_t status;
+    uint32_t cpu_percent;
+    uint32_t user_ms;
+    uint32_t kernel_ms;
+    uint32_t wait_ms;
+    uint32_t switch_count;
+    uint32_t voluntary_switches;
+    uint32_t involuntary_switches;
+} task_stat_t;
+
+/* filled by do_top, terminated by num == -1 */
+extern task_stat_t TaskStat[NUM_MAX_TASK + 2];
+
+/* ready queues to run, one per priority level */
+extern queue_t ready_queue[NUM_PRIORITY_LEVEL];
+
+/* bit i is set <=> ready_queue[i] is not empty */
+extern uint32_t ready_queue_bitmap;
 
 //extern queue_p ready_queue_ptr;
 
@@ -184,6 +239,9 @@ extern queue_t sleeping_queue;
 
 /* current running task PCB */
 extern pcb_t *current_running;
+
+/* the kernel idle context, runs when no task is ready */
+extern pcb_t pcb_init;
 extern pid_t process_id;
 
 extern pcb_t pcb[NUM_MAX_TASK];
@@ -198,13 +256,25 @@ extern void first_entry();
 
 extern void do_scheduler(void);
 extern void do_sleep(uint32_t);
+extern void do_usleep(uint32_t);
+
+extern void ready_queue_push(pcb_t *);
+extern void ready_queue_remove(pcb_t *);
+
+/* insert into sleeping_queue ordered by deadline (in clock cycles) */
+extern void sleeping_queue_push(pcb_t *, uint64_t deadline);
 
 extern void do_block(queue_t *);
 extern void do_unblock_one(queue_t *);
 extern void do_unblock_all(queue_t *);
 
 extern void do_ps();
-extern void do_spawn(task_info_t *task_info);
+extern void do_top();
+
+extern void account_syscall_enter();
+extern void account_syscall_exit();
+extern int do_spawn(task_info_t *task_info);
+extern int do_spawn_cow(task_info_t *task_info);
 extern void do_exit();
 extern int  do_getpid();
 extern void do_waitpid(int n);
@@ -222,5 +292,11 @@ extern mutex_lock_t lock2;
 extern mutex_lock_t *Lock[MAX_LOCK_NUM_TOTAL];
 
 extern uint32_t get_pcb_index(int pid);
+extern pcb_t *get_pcb_by_pid(int pid);
+extern void init_pcb_table();
+
+/* scheduler statistics, used by the sched benchmark */
+extern uint32_t sched_switch_count;
+extern uint32_t sched_switch_cycles;
 
 #endif
\ No newline at end of file
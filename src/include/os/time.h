@@ -29,15 +29,55 @@
 #define INCLUDE_TIME_H_
 
 #include "type.h"
+#include "regs.h"
 
 extern uint32_t time_elapsed;
 
+/* time_elapsed advanced by one timer tick */
+#define TIME_ELAPSED_PER_TICK 15
+/* time_elapsed per get_timer() unit */
+#define TIME_ELAPSED_PER_SECOND 5000
+/* clock cycles per get_timer() unit, i.e. per sys_sleep() unit */
+#define CYCLES_PER_TIMER_UNIT (TIMER_INTERVAL * TIME_ELAPSED_PER_SECOND / TIME_ELAPSED_PER_TICK)
+
+/* longest one-shot when the running task is alone or the cpu is idle */
+#define TIMER_MAX_IDLE_TICKS 1000
+/* shortest one-shot, so CP0_COMPARE is never set behind CP0_COUNT */
+#define TIMER_MIN_INTERVAL 1000
+
+typedef struct timespec {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+} timespec_t;
+
+/* number of timer interrupts taken */
+extern uint32_t timer_irq_count;
+
 uint32_t get_timer(void);
 
 uint32_t get_cp0_count(void);
 
 uint32_t get_ticks(void);
 
+/* monotonic clock */
+uint64_t get_clock_cycles(void);
+uint64_t get_time_ns(void);
+uint64_t usec_to_cycles(uint32_t usec);
+uint32_t cycles_to_msec(uint64_t cycles);
+uint32_t div64_32(uint64_t *n, uint32_t base);
+
+void do_clock_gettime(timespec_t *ts);
+
+void set_cp0_compare(uint32_t compare);
+
+void cpu_idle(void);
+
+/* called from irq_timer */
+void timer_tick(void);
+
+/* a task became ready or a new deadline was queued: fire earlier if needed */
+void timer_kick(void);
+
 void latency(uint32_t time);
 
 #endif
\ No newline at end of file
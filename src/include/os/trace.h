@@ -0,0 +1,54 @@
+#ifndef INCLUDE_TRACE_H_
+#define INCLUDE_TRACE_H_
+
+#include "type.h"
+
+/* event classes */
+#define TRACE_CLASS_FAULT   0x1
+#define TRACE_CLASS_SCHED   0x2
+#define TRACE_CLASS_SYSCALL 0x4
+#define TRACE_CLASS_IRQ     0x8
+#define TRACE_CLASS_ALL     0xf
+
+/* classes compiled in, override with -DTRACE_CLASSES=...; 0 compiles every hook away */
+#ifndef TRACE_CLASSES
+#define TRACE_CLASSES TRACE_CLASS_ALL
+#endif
+
+typedef enum {
+    TRACE_PAGE_FAULT,   // arg0 = badvaddr, arg1 = 1 if a frame was mapped
+    TRACE_SWITCH,       // arg0 = previous pid, arg1 = next pid
+    TRACE_SYSCALL,      // arg0 = syscall number, arg1 = first argument
+    TRACE_IRQ,          // arg0 = interrupt line, arg1 = interrupted epc
+    TRACE_NUM_EVENTS
+} trace_event_t;
+
+/* fixed-size binary record, 16 bytes */
+typedef struct trace_record {
+    uint32_t timestamp; // CP0_COUNT
+    uint16_t event;
+    uint16_t pid;
+    uint32_t arg0;
+    uint32_t arg1;
+} trace_record_t;
+
+#define TRACE_RING_SIZE 256 // power of two
+
+extern trace_record_t trace_ring[TRACE_RING_SIZE];
+/* records ever written, the next one goes to trace_head % TRACE_RING_SIZE */
+extern uint32_t trace_head;
+/* classes recorded at run time, nothing by default */
+extern uint32_t trace_enabled;
+
+void trace_record(uint32_t event, uint32_t arg0, uint32_t arg1);
+int trace_snapshot(trace_record_t *out, int max);
+const char *trace_event_name(uint32_t event);
+
+#define TRACE(class, event, arg0, arg1) \
+do{ \
+    if((TRACE_CLASSES & (class)) && (trace_enabled & (class))){ \
+        trace_record((event), (uint32_t)(arg0), (uint32_t)(arg1)); \
+    } \
+}while(0)
+
+#endif
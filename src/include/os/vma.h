@@ -0,0 +1,35 @@
+#ifndef INCLUDE_VMA_H_
+#define INCLUDE_VMA_H_
+
+#include "type.h"
+#include "sched.h"
+
+/* user address space handed out by the memory API */
+#define USER_HEAP_BASE 0x08000000   // brk grows up from here
+#define USER_MMAP_BASE 0x40000000   // mmap(0, ...) takes the first gap from here
+#define USER_MMAP_END  VM_STACK_MIN
+
+enum {
+    VMA_HEAP  = 1,  // the brk area
+    VMA_MMAP  = 2,
+    VMA_LARGE = 4,  // backed by sys_map_large
+};
+
+/* one mapped range of a process, kept on pcb->vma_list sorted by start */
+typedef struct vm_area {
+    uint32_t start;
+    uint32_t end;       // exclusive, page aligned
+    uint32_t flags;
+    struct vm_area *next;
+} vm_area_t;
+
+bool_t vma_allows(pcb_t *pcb, uint32_t vaddr);
+int vma_copy(pcb_t *dst, pcb_t *src);
+void vma_free_all(pcb_t *pcb);
+
+uint32_t do_mmap(uint32_t addr, uint32_t length);
+int do_munmap(uint32_t addr, uint32_t length);
+uint32_t do_brk(uint32_t addr);
+int do_map_large(uint32_t vaddr, uint32_t size);
+
+#endif
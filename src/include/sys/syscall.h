@@ -32,12 +32,17 @@
 #include "sync.h"
 #include "queue.h"
 #include "sched.h"
+#include "time.h"
 
 #define IGNORE 0
-#define NUM_SYSCALLS 64
+#define NUM_SYSCALLS 128
 
 /* define */
+#define SYSCALL_NULL 1
 #define SYSCALL_SLEEP 2
+#define SYSCALL_USLEEP 3
+#define SYSCALL_CLOCK_GETTIME 4
+#define SYSCALL_BATCH 5
 
 #define SYSCALL_BLOCK 10
 #define SYSCALL_UNBLOCK_ONE 11
@@ -112,13 +117,55 @@
 #define SYSCALL_FS_CP 79
 #define SYSCALL_FS_CHMOD 80
 
+#define SYSCALL_TOP 81
+#define SYSCALL_SPAWN_COW 82
+#define SYSCALL_MAP_LARGE 83
+#define SYSCALL_TLB_WIRE 84
+#define SYSCALL_TLB_UNWIRE 85
+#define SYSCALL_MMAP 86
+#define SYSCALL_MUNMAP 87
+#define SYSCALL_BRK 88
+#define SYSCALL_FS_SYNC 89
+
+/* batched submission: user fills entries at tail, one SYSCALL_BATCH
+ * runs everything between head and tail and writes each ret in place */
+#define SYSCALL_RING_SIZE 64 // power of two
+
+typedef struct syscall_entry {
+    int fn;
+    int arg1;
+    int arg2;
+    int arg3;
+    int ret;
+} syscall_entry_t;
+
+typedef struct syscall_ring {
+    uint32_t head; // next entry the kernel runs
+    uint32_t tail; // next free entry
+    syscall_entry_t entries[SYSCALL_RING_SIZE];
+} syscall_ring_t;
+
 /* syscall function pointer */
 extern int (*syscall[NUM_SYSCALLS])();
 
+/* fast path table, must only hold syscalls that never block or reschedule */
+extern int (*syscall_fast[NUM_SYSCALLS])();
+extern uint32_t syscall_fast_enabled;
+
 extern void system_call_helper(int, int, int, int);
 extern int invoke_syscall(int, int, int, int);
 
+extern int do_null_syscall();
+extern void sys_null();
+
+extern int do_syscall_batch(syscall_ring_t *ring);
+extern void syscall_ring_init(syscall_ring_t *ring);
+extern syscall_entry_t *syscall_ring_push(syscall_ring_t *ring, int fn, int arg1, int arg2, int arg3);
+extern int sys_syscall_batch(syscall_ring_t *ring);
+
 extern void sys_sleep(uint32_t);
+extern void sys_usleep(uint32_t);
+extern void sys_clock_gettime(timespec_t *);
 
 extern void sys_block(queue_t *);
 extern void sys_unblock_one(queue_t *);
@@ -147,11 +194,19 @@ extern void barrier_init(barrier_t *barrier, int n);
 extern void barrier_wait(barrier_t *barrier);
 
 extern void sys_spawn(task_info_t *task_info);
+extern int  sys_spawn_cow(task_info_t *task_info);
+extern int  sys_map_large(uint32_t vaddr, uint32_t size);
+extern int  sys_tlb_wire(uint32_t vaddr);
+extern int  sys_tlb_unwire(uint32_t vaddr);
+extern uint32_t sys_mmap(uint32_t addr, uint32_t length);
+extern int  sys_munmap(uint32_t addr, uint32_t length);
+extern uint32_t sys_brk(uint32_t addr);
 extern void sys_exit();
 extern int  sys_getpid();
 extern void sys_waitpid(int n);
 extern void sys_kill(int n);
 extern void sys_ps();
+extern void sys_top();
 
 extern int sys_scanf(int *mem);
 
@@ -170,6 +225,7 @@ extern void sys_fclose(int fd);
 
 extern void sys_mkfs();
 extern void sys_statfs();
+extern void sys_sync();
 extern void sys_mkdir(char *name);
 extern void sys_rmdir(char *name);
 extern void sys_cd(char *name);
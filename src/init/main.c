@@ -40,13 +40,18 @@
 #include "barrier.h"
 #include "mailbox.h"
 #include "mm.h"
+#include "vma.h"
+#include "kmalloc.h"
 #include "scanf.h"
 #include "mac.h"
 #include "fs.h"
+#include "bcache.h"
+#include "time.h"
 
 int is_init = 0;
 
-queue_t ready_queue;
+queue_t ready_queue[NUM_PRIORITY_LEVEL];
+uint32_t ready_queue_bitmap = 0;
 queue_t block_queue;
 queue_t sleeping_queue;
 
@@ -93,17 +98,14 @@ mutex_lock_t mutex_lock;
 mutex_lock_t mutex_lock_1;
 mutex_lock_t mutex_lock_2;
 
+static task_info_t task_shell = {"shell", (uint32_t)&test_shell, USER_PROCESS};
+static task_info_t task_swapd = {"swapd", (uint32_t)&swap_process, KERNEL_THREAD};
+static task_info_t task_bflushd = {"bflushd", (uint32_t)&bflush_process, KERNEL_THREAD};
+
 static void init_pcb()
 {
 	int i = 0;
 
-	PID++;
-	// flag_spawn = 1;
-
-	for(;i < NUM_MAX_TASK; i++){
-		pcb[i].status = TASK_EXITED;
-	}
-
 	Lock[0] = &lock1;
 	Lock[1] = &lock2;
 
@@ -116,65 +118,26 @@ static void init_pcb()
 		queue_init(&(Lock[i]->mutex_lock_queue));
 	}
 
-	queue_init(&ready_queue);
+	for(i = 0; i < NUM_PRIORITY_LEVEL; i++){
+		queue_init(&ready_queue[i]);
+	}
+	ready_queue_bitmap = 0;
 	queue_init(&block_queue);
 	queue_init(&sleeping_queue);
 
-	queue_init(&(pcb[1].waiting_queue));
-
-	bzero(&(pcb[1].kernel_context), sizeof(pcb[1].kernel_context));
-	bzero(&(pcb[1].user_context  ), sizeof(pcb[1].user_context  ));
-
-	int j = 0;
-	for(; j < LOCK_MAX_NUM; j++){
-		pcb[i].lock[j] = NULL;
-	}
-	pcb[1].kernel_context.regs[29] = STACK_TOP;
-	pcb[1].user_context.regs[29] = STACK_TOP + STACK_SIZE;
-	// pcb[i].user_context.regs[29] = USER_STACK_TOP + VM_STACK_SIZE;
-	pcb[1].kernel_context.regs[30] = STACK_TOP;
-	pcb[1].user_context.regs[30] = STACK_TOP + STACK_SIZE;
-	pcb[1].kernel_stack_top = STACK_TOP;
-	pcb[1].user_stack_top = STACK_TOP + STACK_SIZE;		
-
-	USER_STACK_TOP += VM_STACK_SIZE;
-	STACK_TOP += STACK_SIZE*2;
-	if(STACK_TOP > STACK_MAX)
-	{
-		//TODO
-	}
-
-	pcb[1].prev = NULL;
-	pcb[1].next = NULL;
-	pcb[1].pid = 1;
-	pcb[1].type = USER_PROCESS;
-	pcb[1].status = TASK_CREATED;
-	pcb[1].cursor_x = 0;
-	pcb[1].cursor_y = 0;
+	init_pcb_table();
 
-	pcb[1].entry_point = (uint32_t)&test_shell;
-
-	pcb[1].kernel_context.regs[31] = (uint32_t)first_entry;
-
-	pcb[1].kernel_context.cp0_status = CP0_STATUS_INIT;
-	pcb[1].user_context.cp0_status = CP0_STATUS_INIT;
-
-	pcb[1].kernel_context.cp0_epc = pcb[1].entry_point;
-	pcb[1].user_context.cp0_epc = pcb[1].entry_point;
-	//cp0_epc add 4 automatically when encountering interrupt
-
-	pcb[1].mode = USER_MODE;
-	pcb[1].priority = INITIAL_PRIORITY;
-	pcb[1].wait_time = 0;
-	pcb[1].sleeping_deadline = 0;
-	pcb[1].lock_num = 0;
-
-	queue_push(&ready_queue,&pcb[1]);
+	// the shell gets pid 1, the swap daemon pid 2, the block cache flusher pid 3
+	do_spawn(&task_shell);
+	do_spawn(&task_swapd);
+	do_spawn(&task_bflushd);
 
 	current_running->status = TASK_CREATED;
 
 	current_running->entry_point = 0;
 	current_running->pid = 0;
+	current_running->page_table_base_addr = 0;
+	current_running->asid = 0;
 
 	// flag_spawn = 0;
 }
@@ -208,8 +171,9 @@ static void init_exception()
 	memcpy((uint8_t *)0x80000180, (uint8_t *)exception_handler_begin,\
 		   exception_handler_end-exception_handler_begin);
 
-	memcpy((uint8_t *)0x80000000, (uint8_t *)exception_handler_begin,\
-		   exception_handler_end-exception_handler_begin);
+	// TLB refill vector: walks the page table without saving any context
+	memcpy((uint8_t *)0x80000000, (uint8_t *)tlb_refill_handler_begin,\
+		   tlb_refill_handler_end-tlb_refill_handler_begin);
 
 	// 4. reset CP0_COMPARE & CP0_COUNT register
 	reset_timer();
@@ -222,8 +186,13 @@ static void init_syscall(void)
 
 	for (fn = 0; fn < NUM_SYSCALLS; ++fn) {
 		syscall[fn] = (int (*)()) &invalid_syscall;
+		syscall_fast[fn] = NULL;
 	}
+	syscall[SYSCALL_NULL] = (int (*)()) &do_null_syscall;
+	syscall[SYSCALL_BATCH] = (int (*)()) &do_syscall_batch;
 	syscall[SYSCALL_SLEEP] = (int (*)()) &do_sleep;
+	syscall[SYSCALL_USLEEP] = (int (*)()) &do_usleep;
+	syscall[SYSCALL_CLOCK_GETTIME] = (int (*)()) &do_clock_gettime;
 	syscall[SYSCALL_BLOCK] = (int (*)()) &do_block;
 	syscall[SYSCALL_UNBLOCK_ONE] = (int (*)()) &do_unblock_one;
 	syscall[SYSCALL_UNBLOCK_ALL] = (int (*)()) &do_unblock_all;
@@ -247,8 +216,16 @@ static void init_syscall(void)
 	syscall[SYSCALL_WAITPID] = (int (*)()) &do_waitpid;
 	syscall[SYSCALL_GETPID] = (int (*)()) &do_getpid;
 	syscall[SYSCALL_SPAWN] = (int (*)()) &do_spawn;
+	syscall[SYSCALL_SPAWN_COW] = (int (*)()) &do_spawn_cow;
+	syscall[SYSCALL_MAP_LARGE] = (int (*)()) &do_map_large;
+	syscall[SYSCALL_TLB_WIRE] = (int (*)()) &vm_wire;
+	syscall[SYSCALL_TLB_UNWIRE] = (int (*)()) &vm_unwire;
+	syscall[SYSCALL_MMAP] = (int (*)()) &do_mmap;
+	syscall[SYSCALL_MUNMAP] = (int (*)()) &do_munmap;
+	syscall[SYSCALL_BRK] = (int (*)()) &do_brk;
 	syscall[SYSCALL_KILL] = (int (*)()) &do_kill;
 	syscall[SYSCALL_PS] = (int (*)()) &do_ps;
+	syscall[SYSCALL_TOP] = (int (*)()) &do_top;
 	syscall[SYSCALL_SCANF] = (int (*)()) &do_scanf;
 
     syscall[SYSCALL_INIT_MAC] = (int (*)()) &do_init_mac;
@@ -265,6 +242,7 @@ static void init_syscall(void)
 
 	syscall[SYSCALL_FS_MKFS] = (int (*)()) &do_mkfs;
 	syscall[SYSCALL_FS_STATFS] = (int (*)()) &do_statfs;
+	syscall[SYSCALL_FS_SYNC] = (int (*)()) &do_sync;
 
 	syscall[SYSCALL_FS_MKDIR] = (int (*)()) &do_mkdir;
 	syscall[SYSCALL_FS_RMDIR] = (int (*)()) &do_rmdir;
@@ -292,6 +270,12 @@ static void init_syscall(void)
 	syscall[SYSCALL_FS_CP] = (int (*)()) &do_cp;
 	syscall[SYSCALL_FS_CHMOD] = (int (*)()) &do_chmod;
 
+	// non-blocking calls that may skip the full context save; they run with EXL set,
+	// so they must not touch user memory (a TLB miss there would clobber the saved ra)
+	syscall_fast[SYSCALL_NULL] = syscall[SYSCALL_NULL];
+	syscall_fast[SYSCALL_GETPID] = syscall[SYSCALL_GETPID];
+	syscall_fast[SYSCALL_CURSOR] = syscall[SYSCALL_CURSOR];
+
 }
 
 // jump from bootloader.
@@ -308,15 +292,17 @@ void __attribute__((section(".entry_function"))) _start(void)
 	// init system call table (0_0)
 	init_syscall();
 
+	// init kernel heap on the page frames (^o^)
+	init_kmalloc();
+
 	// init Process Control Block (-_-!)
 	init_pcb();
 
 	// init screen (QAQ)
 	init_screen();
 
-	// init_memory();
-
-	// init_memory();
+	// init TLB and the page frames behind the per-process page tables
+	init_memory();
 
 	init_fs();
 
@@ -325,6 +311,10 @@ void __attribute__((section(".entry_function"))) _start(void)
 		// (QAQQQQQQQQQQQ)
 		// If you do non-preemptive scheduling, you need to use it to surrender control
 		do_scheduler();
+
+		// back here only when no task is runnable:
+		// sleep until the one-shot timer or a device wakes us
+		cpu_idle();
 	};
 	return;
 }
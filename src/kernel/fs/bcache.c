@@ -0,0 +1,259 @@
+#include "bcache.h"
+#include "fs.h"
+#include "kmalloc.h"
+#include "mm.h"
+#include "string.h"
+#include "stdio.h"
+#include "syscall.h"
+
+uint32_t bcache_enabled = 1;
+
+int bcache_hit_count = 0;
+int bcache_miss_count = 0;
+int bcache_sd_read_count = 0;
+int bcache_sd_write_count = 0;
+
+static buf_t bcache[BCACHE_BLOCKS];
+static buf_t *bcache_hash[BCACHE_HASH_SIZE];
+/* LRU sentinel: lru_next is the most recently used buffer, lru_prev the victim */
+static buf_t bcache_lru;
+static uint8_t *bcache_data = NULL;
+
+static void sd_read_block(uint32_t block, uint8_t *dest)
+{
+    sd_card_read(dest, block * BLOCK_SIZE + FS_START_SD_OFFSET, BLOCK_SIZE);
+    bcache_sd_read_count++;
+}
+
+static void sd_write_block(uint32_t block, uint8_t *src)
+{
+    sd_card_write(src, block * BLOCK_SIZE + FS_START_SD_OFFSET, BLOCK_SIZE);
+    bcache_sd_write_count++;
+}
+
+static void lru_unlink(buf_t *buf)
+{
+    buf->lru_prev->lru_next = buf->lru_next;
+    buf->lru_next->lru_prev = buf->lru_prev;
+}
+
+static void lru_push_front(buf_t *buf)
+{
+    buf->lru_next = bcache_lru.lru_next;
+    buf->lru_prev = &bcache_lru;
+    bcache_lru.lru_next->lru_prev = buf;
+    bcache_lru.lru_next = buf;
+}
+
+static void lru_push_back(buf_t *buf)
+{
+    buf->lru_prev = bcache_lru.lru_prev;
+    buf->lru_next = &bcache_lru;
+    bcache_lru.lru_prev->lru_next = buf;
+    bcache_lru.lru_prev = buf;
+}
+
+static buf_t **hash_bucket(uint32_t block)
+{
+    return &bcache_hash[block & (BCACHE_HASH_SIZE - 1)];
+}
+
+static void hash_remove(buf_t *buf)
+{
+    buf_t **link = hash_bucket(buf->block);
+
+    while(*link != NULL){
+        if(*link == buf){
+            *link = buf->hash_next;
+            break;
+        }
+        link = &((*link)->hash_next);
+    }
+    buf->hash_next = NULL;
+}
+
+static buf_t *bcache_lookup(uint32_t block)
+{
+    buf_t *buf;
+    for(buf = *hash_bucket(block); buf != NULL; buf = buf->hash_next){
+        if(buf->block == block){
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+/* the buffer of block, most recently used; the LRU victim is written back if it has to */
+static buf_t *bcache_get(uint32_t block, bool_t fill)
+{
+    buf_t *buf = bcache_lookup(block);
+    buf_t **bucket;
+
+    if(buf != NULL){
+        bcache_hit_count++;
+        lru_unlink(buf);
+        lru_push_front(buf);
+        return buf;
+    }
+
+    buf = bcache_lru.lru_prev;
+    lru_unlink(buf);
+    if(buf->valid){
+        if(buf->dirty){
+            sd_write_block(buf->block, buf->data);
+        }
+        hash_remove(buf);
+    }
+
+    buf->block = block;
+    buf->valid = TRUE;
+    buf->dirty = FALSE;
+    if(fill){
+        bcache_miss_count++;
+        sd_read_block(block, buf->data);
+    }
+    bucket = hash_bucket(block);
+    buf->hash_next = *bucket;
+    *bucket = buf;
+    lru_push_front(buf);
+    return buf;
+}
+
+void bcache_init()
+{
+    int i;
+
+    bcache_lru.lru_next = &bcache_lru;
+    bcache_lru.lru_prev = &bcache_lru;
+    for(i = 0; i < BCACHE_HASH_SIZE; i++){
+        bcache_hash[i] = NULL;
+    }
+
+    if(bcache_data == NULL){
+        bcache_data = (uint8_t *)kmalloc(BCACHE_BLOCKS * BLOCK_SIZE);
+    }
+    if(bcache_data == NULL){
+        printk("[FS] no memory for the block cache, going to the card directly\n");
+        bcache_enabled = 0;
+        return;
+    }
+    for(i = 0; i < BCACHE_BLOCKS; i++){
+        bcache[i].block = 0;
+        bcache[i].valid = FALSE;
+        bcache[i].dirty = FALSE;
+        bcache[i].data = bcache_data + i * BLOCK_SIZE;
+        bcache[i].hash_next = NULL;
+        lru_push_back(&bcache[i]);
+    }
+}
+
+void bcache_read(uint32_t block, uint8_t *dest)
+{
+    if(!bcache_enabled || bcache_data == NULL){
+        sd_read_block(block, dest);
+        return;
+    }
+    memcpy(dest, bcache_get(block, TRUE)->data, BLOCK_SIZE);
+}
+
+/* a whole block is written, so a miss does not read the old contents first */
+void bcache_write(uint32_t block, uint8_t *src)
+{
+    buf_t *buf;
+
+    if(!bcache_enabled || bcache_data == NULL){
+        sd_write_block(block, src);
+        //a cached copy would be stale now
+        if(bcache_data != NULL && (buf = bcache_lookup(block)) != NULL){
+            hash_remove(buf);
+            buf->valid = FALSE;
+            buf->dirty = FALSE;
+            lru_unlink(buf);
+            lru_push_back(buf);
+        }
+        return;
+    }
+    buf = bcache_get(block, FALSE);
+    memcpy(buf->data, src, BLOCK_SIZE);
+    buf->dirty = TRUE;
+}
+
+/*
+ * n consecutive blocks of file data, in as few card transfers as possible.
+ * cached copies are used where they exist (they may be newer than the card),
+ * the rest is read straight into dest without taking slots from the metadata.
+ */
+void bcache_read_run(uint32_t block, uint32_t n, uint8_t *dest)
+{
+    uint32_t i = 0, run;
+    bool_t cached = bcache_enabled && bcache_data != NULL;
+    buf_t *buf;
+
+    while(i < n){
+        if(cached && (buf = bcache_lookup(block + i)) != NULL){
+            bcache_hit_count++;
+            memcpy(dest + i * BLOCK_SIZE, buf->data, BLOCK_SIZE);
+            i++;
+            continue;
+        }
+        for(run = 1; i + run < n && !(cached && bcache_lookup(block + i + run) != NULL); run++)
+            ;
+        sd_card_read(dest + i * BLOCK_SIZE, (block + i) * BLOCK_SIZE + FS_START_SD_OFFSET, run * BLOCK_SIZE);
+        bcache_sd_read_count++;
+        i += run;
+    }
+}
+
+/* written through in one transfer, cached copies of the blocks are refreshed and clean */
+void bcache_write_run(uint32_t block, uint32_t n, uint8_t *src)
+{
+    uint32_t i;
+    buf_t *buf;
+
+    sd_card_write(src, block * BLOCK_SIZE + FS_START_SD_OFFSET, n * BLOCK_SIZE);
+    bcache_sd_write_count++;
+    if(bcache_data == NULL){
+        return;
+    }
+    for(i = 0; i < n; i++){
+        if((buf = bcache_lookup(block + i)) != NULL){
+            memcpy(buf->data, src + i * BLOCK_SIZE, BLOCK_SIZE);
+            buf->dirty = FALSE;
+        }
+    }
+}
+
+void bcache_sync()
+{
+    int i;
+
+    if(bcache_data == NULL){
+        return;
+    }
+    for(i = 0; i < BCACHE_BLOCKS; i++){
+        if(bcache[i].valid && bcache[i].dirty){
+            bcache[i].dirty = FALSE;
+            sd_write_block(bcache[i].block, bcache[i].data);
+        }
+    }
+}
+
+void do_sync()
+{
+    bcache_sync();
+}
+
+/* kernel thread: write dirty blocks back every BCACHE_FLUSH_INTERVAL */
+void bflush_process()
+{
+    uint32_t cp0_status;
+
+    while(1){
+        sys_sleep(BCACHE_FLUSH_INTERVAL);
+
+        cp0_status = get_cp0_status();
+        set_cp0_status(cp0_status & 0xfffffffe);
+        bcache_sync();
+        set_cp0_status(cp0_status);
+    }
+}
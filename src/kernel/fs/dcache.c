@@ -0,0 +1,112 @@
+#include "dcache.h"
+#include "string.h"
+
+int dcache_hit_count = 0;
+int dcache_miss_count = 0;
+
+static dcache_entry_t dcache[DCACHE_ENTRIES];
+static dcache_entry_t *dcache_hash[DCACHE_HASH_SIZE];
+/* entries are reused round robin */
+static uint32_t dcache_hand = 0;
+
+static dcache_entry_t **hash_bucket(uint32_t parent, const char *name)
+{
+    uint32_t h = parent * 31;
+    while(*name != '\0'){
+        h = h * 33 + (uint8_t)*name++;
+    }
+    return &dcache_hash[h & (DCACHE_HASH_SIZE - 1)];
+}
+
+static void hash_remove(dcache_entry_t *entry)
+{
+    dcache_entry_t **link = hash_bucket(entry->parent, entry->name);
+
+    while(*link != NULL){
+        if(*link == entry){
+            *link = entry->hash_next;
+            break;
+        }
+        link = &((*link)->hash_next);
+    }
+    entry->hash_next = NULL;
+    entry->valid = FALSE;
+}
+
+static dcache_entry_t *dcache_find(uint32_t parent, const char *name)
+{
+    dcache_entry_t *entry;
+    for(entry = *hash_bucket(parent, name); entry != NULL; entry = entry->hash_next){
+        if(entry->parent == parent && strcmp((char *)name, entry->name) == 0){
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void dcache_init()
+{
+    bzero(dcache, sizeof(dcache));
+    bzero(dcache_hash, sizeof(dcache_hash));
+    dcache_hand = 0;
+}
+
+bool_t dcache_lookup(uint32_t parent, const char *name, int *inum)
+{
+    dcache_entry_t *entry = dcache_find(parent, name);
+
+    if(entry == NULL){
+        dcache_miss_count++;
+        return FALSE;
+    }
+    dcache_hit_count++;
+    *inum = entry->inum;
+    return TRUE;
+}
+
+/* names that do not fit are simply not cached */
+void dcache_insert(uint32_t parent, const char *name, int inum)
+{
+    dcache_entry_t *entry;
+    dcache_entry_t **bucket;
+
+    if(strlen((char *)name) >= MAX_NAME_LENGTH){
+        return;
+    }
+    if((entry = dcache_find(parent, name)) != NULL){
+        entry->inum = inum;
+        return;
+    }
+
+    entry = &dcache[dcache_hand];
+    dcache_hand = (dcache_hand + 1) % DCACHE_ENTRIES;
+    if(entry->valid){
+        hash_remove(entry);
+    }
+    entry->valid = TRUE;
+    entry->parent = parent;
+    entry->inum = inum;
+    strcpy(entry->name, (char *)name);
+    bucket = hash_bucket(parent, name);
+    entry->hash_next = *bucket;
+    *bucket = entry;
+}
+
+void dcache_forget(uint32_t parent, const char *name)
+{
+    dcache_entry_t *entry = dcache_find(parent, name);
+    if(entry != NULL){
+        hash_remove(entry);
+    }
+}
+
+/* parent is gone, and its inum may come back as something else */
+void dcache_forget_dir(uint32_t parent)
+{
+    int i;
+    for(i = 0; i < DCACHE_ENTRIES; i++){
+        if(dcache[i].valid && dcache[i].parent == parent){
+            hash_remove(&dcache[i]);
+        }
+    }
+}
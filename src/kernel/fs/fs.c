@@ -25,6 +25,8 @@
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *  * * * * * * * * * * */
 
 #include "fs.h"
+#include "bcache.h"
+#include "dcache.h"
 #include "time.h"
 /*
 * SD card file system for OS seminar
@@ -60,6 +62,10 @@ uint32_t buffer2[POINTER_PER_BLOCK] = {0};
 uint32_t buffer3[POINTER_PER_BLOCK] = {0};
 uint32_t buffer0[POINTER_PER_BLOCK] = {0};
 
+//pointer blocks of the inodes walked last, normally the open files; block 0 never holds pointers
+static bmap_cache_t bmap_cache[BMAP_CACHE_NUM];
+static uint32_t bmap_clock = 0;
+
 inode_t root_inode;
 inode_t *root_inode_ptr = &root_inode;
 
@@ -71,8 +77,9 @@ inode_t *current_dir_link_ptr = &current_dir_link;
 
 uint8_t cat_buffer[CAT_MAX_LENGTH] = {0};
 
-uint8_t fread_buffer[FILE_READ_MAX_LENGTH];
-uint8_t fwrite_buffer[FILE_WRITE_MAX_LENGTH];
+//one block more than the longest transfer, for one that does not start on a block boundary
+uint8_t fread_buffer[FILE_READ_MAX_LENGTH + BLOCK_SIZE];
+uint8_t fwrite_buffer[FILE_WRITE_MAX_LENGTH + BLOCK_SIZE];
 
 char parent_buffer[MAX_PATH_LENGTH];
 char parent_buffer_1[MAX_PATH_LENGTH];
@@ -84,18 +91,50 @@ dentry_t ls_buffer[MAX_LS_NUM] = {0};
 
 // static uint32_t flag_first_write = 0;
 
+//the copies in memory are the real ones, these say which 4KB blocks the disk is behind on
+static uint32_t blockbmp_dirty = 0;     //bit i: block BLOCK_BMP_BLOCK_INDEX + i
+static bool_t superblock_dirty = FALSE;
+
+//free blocks under each bitmap block, so full stretches are skipped whole
+static uint32_t blockbmp_free[BLOCK_BMP_BLOCKS_NUM];
+//next fit: the search for free blocks starts where the last allocation ended
+static uint32_t alloc_cursor = DATA_BLOCK_INDEX;
+
 static void set_block_bmp(uint32_t block_index)
 {
+    if(!check_bitmap((BitMap_t)blockbmp_buffer, block_index)){
+        blockbmp_free[block_index / BLOCK_BMP_NUM_PER_BLOCK]--;
+    }
     set_bitmap((BitMap_t)blockbmp_buffer, block_index);        
+    blockbmp_dirty |= 1 << (block_index / BLOCK_BMP_NUM_PER_BLOCK);
     return;
 }
 
 static void unset_block_bmp(uint32_t block_index)
 {
+    if(check_bitmap((BitMap_t)blockbmp_buffer, block_index)){
+        blockbmp_free[block_index / BLOCK_BMP_NUM_PER_BLOCK]++;
+    }
     unset_bitmap((BitMap_t)blockbmp_buffer, block_index);
+    blockbmp_dirty |= 1 << (block_index / BLOCK_BMP_NUM_PER_BLOCK);
     return;
 }
 
+static void count_free_blocks()
+{
+    int i, j;
+    uint8_t byte;
+
+    for(i = 0; i < BLOCK_BMP_BLOCKS_NUM; i++){
+        blockbmp_free[i] = 0;
+        for(j = 0; j < BLOCK_SIZE; j++){
+            for(byte = ~blockbmp_buffer[i * BLOCK_SIZE + j]; byte != 0; byte &= byte - 1){
+                blockbmp_free[i]++;
+            }
+        }
+    }
+}
+
 static bool_t check_block_bmp(uint32_t block_index)
 {
     return check_bitmap((BitMap_t)blockbmp_buffer, block_index);
@@ -130,18 +169,26 @@ void sd_card_write(void *dest, uint32_t sd_offset, uint32_t size)
     sdwrite((char *)dest, sd_offset, size);
 }
 
-//only write_block(), and read_block() interact with SD card
+//only write_block(), and read_block() interact with SD card, through the block cache
 //other func interact with buffer in memory
 static void write_block(uint32_t block_index, uint8_t *block_buffer)
 {
-    uint32_t sd_offset = block_index*BLOCK_SIZE + FS_START_SD_OFFSET;
-    sd_card_write(block_buffer, sd_offset, BLOCK_SIZE);
+    int i, d;
+
+    bcache_write(block_index, block_buffer);
+    //a cached pointer block follows its new contents
+    for(i = 0; i < BMAP_CACHE_NUM; i++){
+        for(d = 0; d < BMAP_DEPTH; d++){
+            if(bmap_cache[i].bc_block[d] == block_index){
+                memcpy((uint8_t *)bmap_cache[i].bc_ptr[d], block_buffer, BLOCK_SIZE);
+            }
+        }
+    }
 }
 
 static void read_block(uint32_t block_index, uint8_t *block_buffer)
 {
-    uint32_t sd_offset = block_index*BLOCK_SIZE + FS_START_SD_OFFSET;
-    sd_card_read(block_buffer, sd_offset, BLOCK_SIZE);
+    bcache_read(block_index, block_buffer);
 }
 
 //sync from memory to disk
@@ -150,18 +197,108 @@ static void sync_to_disk_inode_bmp()
     write_block(INODE_BMP_BLOCK_INDEX, inodebmp_block_buffer);
 }
 
+//only the bitmap blocks that changed
 static void sync_to_disk_block_bmp()
 {
     int i = 0;
     for(; i < BLOCK_BMP_BLOCKS_NUM; i++){
-        write_block(BLOCK_BMP_BLOCK_INDEX + i, blockbmp_buffer + BLOCK_SIZE * i);
+        if(blockbmp_dirty & (1 << i)){
+            write_block(BLOCK_BMP_BLOCK_INDEX + i, blockbmp_buffer + BLOCK_SIZE * i);
+        }
     }
+    blockbmp_dirty = 0;
     return;
 }
 
 static void sync_to_disk_superblock()
 {
     write_block(SUPERBLOCK_BLOCK_INDEX, superblock_buffer);
+    superblock_dirty = FALSE;
+}
+
+//bitmap blocks and superblock changed by the allocations of one operation, written once at its end
+static void sync_to_disk_meta()
+{
+    sync_to_disk_block_bmp();
+    if(superblock_dirty){
+        sync_to_disk_superblock();
+    }
+}
+
+//first free block in [from, end), -1 if there is none
+static int next_free_block(uint32_t from, uint32_t end)
+{
+    uint32_t group_end;
+    int block_index;
+
+    while(from < end){
+        group_end = (from / BLOCK_BMP_NUM_PER_BLOCK + 1) * BLOCK_BMP_NUM_PER_BLOCK;
+        if(group_end > end){
+            group_end = end;
+        }
+        if(blockbmp_free[from / BLOCK_BMP_NUM_PER_BLOCK] != 0
+           && (block_index = find_zero_bitmap((BitMap_t)blockbmp_buffer, from, group_end)) >= 0){
+            return block_index;
+        }
+        from = group_end;
+    }
+    return -1;
+}
+
+static uint32_t free_run_length(uint32_t block_index, uint32_t max)
+{
+    uint32_t len = 0;
+    while(len < max && block_index + len < BLOCK_NUM && !check_block_bmp(block_index + len)){
+        len++;
+    }
+    return len;
+}
+
+/*
+ * take want contiguous blocks, the first such run from the cursor on (wrapping
+ * around once). if there is none the longest run seen is taken and *got says
+ * how many; the caller asks again for the rest. the disk copies of the bitmap 
+ * and superblock follow on sync_to_disk_meta().
+ */
+static int alloc_extent(uint32_t want, uint32_t *got)
+{
+    uint32_t from = alloc_cursor, end = BLOCK_NUM;
+    uint32_t len, best_len = 0, i;
+    int block_index, best = -1, pass;
+
+    for(pass = 0; pass < 2 && best_len < want; pass++){
+        while(best_len < want && (block_index = next_free_block(from, end)) >= 0){
+            len = free_run_length(block_index, want);
+            if(len > best_len){
+                best = block_index;
+                best_len = len;
+            }
+            from = block_index + len;
+        }
+        from = DATA_BLOCK_INDEX;
+        end = alloc_cursor;
+    }
+    if(best < 0){
+        vt100_move_cursor(1, 45);
+        printk("[FS ERROR] ERROR_NO_FREE_BLOCK\n");
+        return ERROR_NO_FREE_BLOCK;
+    }
+
+    for(i = 0; i < best_len; i++){
+        set_block_bmp(best + i);
+    }
+    superblock_ptr->s_free_blocks_cnt -= best_len;
+    superblock_dirty = TRUE;
+
+    alloc_cursor = (best + best_len < BLOCK_NUM) ? best + best_len : DATA_BLOCK_INDEX;
+    *got = best_len;
+    return best;
+}
+
+static int alloc_block()
+{
+    uint32_t got;
+    return alloc_extent(1, &got);
 }
 
 static void sync_to_disk_inode_table(uint32_t inode_table_offset)
@@ -191,6 +328,8 @@ static void sync_from_disk_block_bmp()
     for(; i < BLOCK_BMP_BLOCKS_NUM; i++){
         read_block(BLOCK_BMP_BLOCK_INDEX + i, blockbmp_buffer + BLOCK_SIZE * i);
     }
+    blockbmp_dirty = 0;
+    count_free_blocks();
     return;
 }
 
@@ -280,12 +419,7 @@ static int write_dentry(inode_t* inode_ptr, uint32_t dnum, dentry_t* dentry_ptr)
     dentry_t *dentry_table = (dentry_t *)dentry_block_buffer;
 
     if(get_block_index_in_inode(inode_ptr, major_index) == 0){
-        uint32_t free_block_index = find_free_block();
-        set_block_bmp(free_block_index);
-        sync_to_disk_block_bmp();
-
-        superblock_ptr->s_free_blocks_cnt--;
-        sync_to_disk_superblock();
+        uint32_t free_block_index = alloc_block();
 
         write_block_index_in_inode(inode_ptr, major_index, free_block_index);
         inode_ptr->i_fsize += BLOCK_SIZE;
@@ -297,10 +431,18 @@ static int write_dentry(inode_t* inode_ptr, uint32_t dnum, dentry_t* dentry_ptr)
         sync_to_disk_inode(inode_ptr);
 
         read_block(get_block_index_in_inode(inode_ptr, major_index), dentry_block_buffer);
+        //the name this slot held is looked up again next time
+        if(dentry_table[minor_index].d_name[0] != '\0'){
+            dcache_forget(inode_ptr->i_num, dentry_table[minor_index].d_name);
+        }
     }
     memcpy((uint8_t *)(&(dentry_table[minor_index])), (uint8_t *)dentry_ptr, DENTRY_SIZE);
+    //and so is the new one, it may be cached as missing
+    dcache_forget(inode_ptr->i_num, dentry_ptr->d_name);
     write_block(get_block_index_in_inode(inode_ptr, major_index), dentry_block_buffer);
 
+    //covers the caller's inode and block allocations too
+    sync_to_disk_meta();
     return;
 }
 
@@ -343,12 +485,67 @@ void separate_path(const char *path, char *parent, char *name)
     return;
 }
 
-int get_block_index_in_inode(inode_t *inode_ptr, uint32_t idx)
+static void bmap_forget(uint32_t inum)
 {
-    bzero(buffer1, POINTER_PER_BLOCK*sizeof(uint32_t));
-    bzero(buffer2, POINTER_PER_BLOCK*sizeof(uint32_t));
-    bzero(buffer3, POINTER_PER_BLOCK*sizeof(uint32_t));
-    
+    int i;
+    for(i = 0; i < BMAP_CACHE_NUM; i++){
+        if(bmap_cache[i].bc_inum == inum){
+            bzero(bmap_cache[i].bc_block, sizeof(bmap_cache[i].bc_block));
+        }
+    }
+}
+
+static void bmap_forget_all()
+{
+    bzero(bmap_cache, sizeof(bmap_cache));
+    bmap_clock = 0;
+}
+
+//the cache of inum, the least recently used one is taken over if it has none
+static bmap_cache_t *bmap_get(uint32_t inum)
+{
+    bmap_cache_t *c = &bmap_cache[0];
+    int i;
+
+    for(i = 0; i < BMAP_CACHE_NUM; i++){
+        if(bmap_cache[i].bc_inum == inum){
+            c = &bmap_cache[i];
+            break;
+        }
+        if(bmap_cache[i].bc_used < c->bc_used){
+            c = &bmap_cache[i];
+        }
+    }
+    if(i == BMAP_CACHE_NUM){
+        c->bc_inum = inum;
+        bzero(c->bc_block, sizeof(c->bc_block));
+    }
+    c->bc_used = ++bmap_clock;
+    return c;
+}
+
+//pointer block block_index at depth, read only if the cache holds another one there
+static uint32_t *bmap_level(bmap_cache_t *c, int depth, uint32_t block_index)
+{
+    if(c->bc_block[depth] != block_index){
+        read_block(block_index, (uint8_t *)c->bc_ptr[depth]);
+        c->bc_block[depth] = block_index;
+    }
+    return c->bc_ptr[depth];
+}
+
+static int bmap_lookup(bmap_cache_t *c, inode_t *inode_ptr, uint32_t idx)
+{
+    uint32_t *p;
+    int i;
+
+    //blocks allocated as an extent need no walk
+    for(i = 0; i < INODE_EXTENT_NUM; i++){
+        if(idx - inode_ptr->i_extent[i].e_fblock < inode_ptr->i_extent[i].e_len){
+            return inode_ptr->i_extent[i].e_block + (idx - inode_ptr->i_extent[i].e_fblock);
+        }
+    }
+
     if(idx < FIRST_POINTER){
         return inode_ptr->i_direct_table[idx];
     }
@@ -356,35 +553,80 @@ int get_block_index_in_inode(inode_t *inode_ptr, uint32_t idx)
         if(inode_ptr->i_indirect_block_1_ptr == 0){
             return -1;
         }
-        read_block(inode_ptr->i_indirect_block_1_ptr, (uint8_t *)buffer1);
-        return buffer1[idx - FIRST_POINTER];
+        p = bmap_level(c, 0, inode_ptr->i_indirect_block_1_ptr);
+        return p[idx - FIRST_POINTER];
     }
     if(idx < THIRD_POINTER){
-        if(inode_ptr->i_indirect_block_1_ptr == 0){
+        if(inode_ptr->i_indirect_block_2_ptr == 0){
             return -1;
         }
-        read_block(inode_ptr->i_indirect_block_1_ptr, (uint8_t *)buffer1);
-        if(buffer1[(idx - SECOND_POINTER) / POINTER_PER_BLOCK] == 0){
+        p = bmap_level(c, 0, inode_ptr->i_indirect_block_2_ptr);
+        if(p[(idx - SECOND_POINTER) / POINTER_PER_BLOCK] == 0){
             return -1;
         }
-        read_block(buffer1[(idx - SECOND_POINTER) / POINTER_PER_BLOCK], (uint8_t *)buffer2);
-        return buffer2[(idx - SECOND_POINTER) % POINTER_PER_BLOCK];
+        p = bmap_level(c, 1, p[(idx - SECOND_POINTER) / POINTER_PER_BLOCK]);
+        return p[(idx - SECOND_POINTER) % POINTER_PER_BLOCK];
     }
     if(idx < MAX_BLOCK_INDEX){
-        if(inode_ptr->i_indirect_block_1_ptr == 0){
+        if(inode_ptr->i_indirect_block_3_ptr == 0){
             return -1;
         }
-        read_block(inode_ptr->i_indirect_block_1_ptr, (uint8_t *)buffer1);
-        if(buffer1[(idx - THIRD_POINTER) / (POINTER_PER_BLOCK * POINTER_PER_BLOCK)] == 0){
+        p = bmap_level(c, 0, inode_ptr->i_indirect_block_3_ptr);
+        if(p[(idx - THIRD_POINTER) / (POINTER_PER_BLOCK * POINTER_PER_BLOCK)] == 0){
             return -1;
-        } 
-        read_block(buffer1[(idx - THIRD_POINTER) / (POINTER_PER_BLOCK * POINTER_PER_BLOCK)], (uint8_t *)buffer2);
-        if(buffer2[((idx - THIRD_POINTER) % (POINTER_PER_BLOCK * POINTER_PER_BLOCK)) / POINTER_PER_BLOCK] == 0){
+        }
+        p = bmap_level(c, 1, p[(idx - THIRD_POINTER) / (POINTER_PER_BLOCK * POINTER_PER_BLOCK)]);
+        if(p[((idx - THIRD_POINTER) % (POINTER_PER_BLOCK * POINTER_PER_BLOCK)) / POINTER_PER_BLOCK] == 0){
             return -1;
-        } 
-        read_block(buffer2[((idx - THIRD_POINTER) % (POINTER_PER_BLOCK * POINTER_PER_BLOCK)) / POINTER_PER_BLOCK], (uint8_t *)buffer3);
-        return buffer3[(idx - THIRD_POINTER) % POINTER_PER_BLOCK];
-    }   
+        }
+        p = bmap_level(c, 2, p[((idx - THIRD_POINTER) % (POINTER_PER_BLOCK * POINTER_PER_BLOCK)) / POINTER_PER_BLOCK]);
+        return p[(idx - THIRD_POINTER) % POINTER_PER_BLOCK];
+    }
+    return -1;
+}
+
+//direct blocks need no cache, directory lookups leave the ones of the open files alone
+int get_block_index_in_inode(inode_t *inode_ptr, uint32_t idx)
+{
+    return bmap_lookup((idx < FIRST_POINTER) ? NULL : bmap_get(inode_ptr->i_num), inode_ptr, idx);
+}
+
+//disk blocks behind file blocks [begin, begin + n), 0 where the file has none
+void get_block_range_in_inode(inode_t *inode_ptr, uint32_t begin, uint32_t n, uint32_t *blocks)
+{
+    bmap_cache_t *c = (begin + n <= FIRST_POINTER) ? NULL : bmap_get(inode_ptr->i_num);
+    uint32_t i;
+    int block_index;
+
+    for(i = 0; i < n; i++){
+        block_index = bmap_lookup(c, inode_ptr, begin + i);
+        blocks[i] = (block_index > 0) ? block_index : 0;
+    }
+}
+
+//file blocks [fblock, fblock + len) are disk blocks [block_index, block_index + len), an extent that ends right there grows
+static void inode_add_extent(inode_t *inode_ptr, uint32_t fblock, uint32_t block_index, uint32_t len)
+{
+    extent_t *e;
+    int i;
+
+    for(i = 0; i < INODE_EXTENT_NUM; i++){
+        e = &inode_ptr->i_extent[i];
+        if(e->e_len != 0 && e->e_fblock + e->e_len == fblock && e->e_block + e->e_len == block_index){
+            e->e_len += len;
+            return;
+        }
+    }
+    for(i = 0; i < INODE_EXTENT_NUM; i++){
+        e = &inode_ptr->i_extent[i];
+        if(e->e_len == 0){
+            e->e_fblock = fblock;
+            e->e_block = block_index;
+            e->e_len = len;
+            return;
+        }
+    }
+    //no slot left, the block pointers still map it
 }
 
 void write_block_index_in_inode(inode_t *inode_ptr, uint32_t idx, uint32_t block_index)
@@ -402,13 +644,7 @@ void write_block_index_in_inode(inode_t *inode_ptr, uint32_t idx, uint32_t block
     uint32_t free_index_1;
     if(idx < SECOND_POINTER){
         if(inode_ptr->i_indirect_block_1_ptr == 0){
-            free_index_1 = find_free_block();
-
-            set_block_bmp(free_index_1);
-            sync_to_disk_block_bmp();
-
-            superblock_ptr->s_free_blocks_cnt--;
-            sync_to_disk_superblock();
+            free_index_1 = alloc_block();
 
             clear_block_index(free_index_1);
             inode_ptr->i_indirect_block_1_ptr = free_index_1;
@@ -424,13 +660,7 @@ void write_block_index_in_inode(inode_t *inode_ptr, uint32_t idx, uint32_t block
     uint32_t free_index_2;
     if(idx < THIRD_POINTER){
         if(inode_ptr->i_indirect_block_2_ptr == 0){
-            free_index_1 = find_free_block();
-
-            set_block_bmp(free_index_1);
-            sync_to_disk_block_bmp();
-
-            superblock_ptr->s_free_blocks_cnt--;
-            sync_to_disk_superblock();
+            free_index_1 = alloc_block();
 
             clear_block_index(free_index_1);
             inode_ptr->i_indirect_block_2_ptr = free_index_1;
@@ -439,13 +669,7 @@ void write_block_index_in_inode(inode_t *inode_ptr, uint32_t idx, uint32_t block
         }
         read_block(inode_ptr->i_indirect_block_2_ptr, (uint8_t *)buffer1);
         if(buffer1[(idx - SECOND_POINTER) / POINTER_PER_BLOCK] == 0){
-            free_index_2 = find_free_block();
-
-            set_block_bmp(free_index_2);
-            sync_to_disk_block_bmp();
-
-            superblock_ptr->s_free_blocks_cnt--;
-            sync_to_disk_superblock();
+            free_index_2 = alloc_block();
 
             clear_block_index(free_index_2);
             inode_ptr->i_fsize += BLOCK_SIZE;
@@ -457,18 +681,13 @@ void write_block_index_in_inode(inode_t *inode_ptr, uint32_t idx, uint32_t block
         read_block(buffer1[(idx - SECOND_POINTER) / POINTER_PER_BLOCK], (uint8_t *)buffer2);
         buffer2[(idx - SECOND_POINTER) % POINTER_PER_BLOCK] = block_index;
         write_block(buffer1[(idx - SECOND_POINTER) / POINTER_PER_BLOCK], (uint8_t *)buffer2);
+        return;
     }
 
     uint32_t free_index_3;
     if(idx < MAX_BLOCK_INDEX){
         if(inode_ptr->i_indirect_block_3_ptr == 0){
-            free_index_1 = find_free_block();
-
-            set_block_bmp(free_index_1);
-            sync_to_disk_block_bmp();
-
-            superblock_ptr->s_free_blocks_cnt--;
-            sync_to_disk_superblock();
+            free_index_1 = alloc_block();
 
             clear_block_index(free_index_1);
             inode_ptr->i_indirect_block_3_ptr = free_index_1;
@@ -477,30 +696,18 @@ void write_block_index_in_inode(inode_t *inode_ptr, uint32_t idx, uint32_t block
         }
         read_block(inode_ptr->i_indirect_block_3_ptr, (uint8_t *)buffer1);
         if(buffer1[(idx - THIRD_POINTER) / (POINTER_PER_BLOCK * POINTER_PER_BLOCK)] == 0){
-            free_index_2 = find_free_block();
-
-            set_block_bmp(free_index_2);
-            sync_to_disk_block_bmp();
-
-            superblock_ptr->s_free_blocks_cnt--;
-            sync_to_disk_superblock();
+            free_index_2 = alloc_block();
 
             clear_block_index(free_index_2);
             inode_ptr->i_fsize += BLOCK_SIZE;
             sync_to_disk_inode(inode_ptr);
 
             buffer1[(idx - THIRD_POINTER) / (POINTER_PER_BLOCK * POINTER_PER_BLOCK)] = free_index_2;
-            write_block(inode_ptr->i_indirect_block_2_ptr, (uint8_t *)buffer1);
+            write_block(inode_ptr->i_indirect_block_3_ptr, (uint8_t *)buffer1);
         }
         read_block(buffer1[(idx - THIRD_POINTER) / (POINTER_PER_BLOCK * POINTER_PER_BLOCK)], (uint8_t *)buffer2);
         if(buffer2[((idx - THIRD_POINTER) % (POINTER_PER_BLOCK * POINTER_PER_BLOCK)) / POINTER_PER_BLOCK] == 0){
-            free_index_3 = find_free_block();
-
-            set_block_bmp(free_index_3);
-            sync_to_disk_block_bmp();
-
-            superblock_ptr->s_free_blocks_cnt--;
-            sync_to_disk_superblock();
+            free_index_3 = alloc_block();
 
             clear_block_index(free_index_3);
             inode_ptr->i_fsize += BLOCK_SIZE;
@@ -517,77 +724,46 @@ void write_block_index_in_inode(inode_t *inode_ptr, uint32_t idx, uint32_t block
     return;
 }
 
-// int find_file(inode_t *inode_ptr, const char *name)
-int find_file(inode_t *inode_ptr, char *name)
+//dentry number of name, -1 if there is none; the scan stops at the first block the directory does not have
+static int scan_dir(inode_t *inode_ptr, const char *name)
 {
-    bzero(find_file_buffer, BLOCK_SIZE);
     dentry_t *p = (dentry_t *)find_file_buffer;
-    int i = 0, j = 0;
-    for(; i < MAX_BLOCK_INDEX; i++){
-        uint32_t block_index = get_block_index_in_inode(inode_ptr, i);
-        read_block(block_index, find_file_buffer);
+    int block_index;
+    uint32_t i, j;
 
-        // for(; j < POINTER_PER_BLOCK; j++){
-        for(; j < DENTRY_NUM_PER_BLOCK; j++){
+    for(i = 0; i < MAX_DENTRY_BLOCK_NUM; i++){
+        block_index = get_block_index_in_inode(inode_ptr, i);
+        if(block_index <= 0){
+            break;
+        }
+        read_block(block_index, find_file_buffer);
+        for(j = 0; j < DENTRY_NUM_PER_BLOCK; j++){
             if(strcmp((char *)name, p[j].d_name) == 0){
-
-                // //debug
-                // vt100_move_cursor(1, 26);
-                // printk("[DEBUG 1 find_file] strcmp:%d, j:%d, block_index:%d, p[i].d_name:%s", \
-                //         strcmp((char *)name, p[j].d_name), j, block_index, p[i].d_name);
-                // printk(", name:%s", name);
-                
-                return p[j].d_inum;
+                return (i * DENTRY_NUM_PER_BLOCK + j);
             }
         }
     }
     return -1;
 }
 
-static int _find_file(inode_t *inode_ptr, char *name)
+//an empty name matches a free slot, that answer changes with every dentry and is never cached
+int find_file(inode_t *inode_ptr, char *name)
 {
-    bzero(find_file_buffer, BLOCK_SIZE);
-    dentry_t *p = (dentry_t *)find_file_buffer;
-    int i = 0, j = 0;
-    for(; i < 2; i++){
-        uint32_t block_index = get_block_index_in_inode(inode_ptr, i);
-        read_block(block_index, find_file_buffer);
-
-        // for(; j < POINTER_PER_BLOCK; j++){
-        for(; j < DENTRY_NUM_PER_BLOCK; j++){
-            if(strcmp((char *)name, p[j].d_name) == 0){
+    int inum, dnum;
 
-                // //debug
-                // vt100_move_cursor(1, 26);
-                // printk("[DEBUG 1 find_file] strcmp:%d, j:%d, block_index:%d, p[i].d_name:%s", \
-                //         strcmp((char *)name, p[j].d_name), j, block_index, p[i].d_name);
-                // printk(", name:%s", name);
-                
-                return p[j].d_inum;
-            }
-        }
+    if(name[0] != '\0' && dcache_lookup(inode_ptr->i_num, name, &inum)){
+        return inum;
     }
-    return -1;
+    dnum = scan_dir(inode_ptr, name);
+    inum = (dnum < 0) ? -1 : ((dentry_t *)find_file_buffer)[dnum % DENTRY_NUM_PER_BLOCK].d_inum;
+    if(name[0] != '\0'){
+        dcache_insert(inode_ptr->i_num, name, inum);
+    }
+    return inum;
 }
 
 int find_dentry(inode_t* inode_ptr, const char* name) {
-    bzero(find_file_buffer, BLOCK_SIZE);
-    dentry_t *p = (dentry_t *)find_file_buffer;
-    int i = 0, j = 0;
-    // for(; i < MAX_BLOCK_INDEX; i++){
-    //MAX_BLOCK_INDEX is TOO BIG!!!!!!!!
-    // for(; i < FIRST_POINTER; i++){
-    for(; i < MAX_DENTRY_BLOCK_NUM; i++){
-        uint32_t block_index = get_block_index_in_inode(inode_ptr, i);
-        read_block(block_index, find_file_buffer);
-        // for(; j < POINTER_PER_BLOCK; j++){
-        for(; j < DENTRY_NUM_PER_BLOCK; j++){
-            if(strcmp((char *)name, p[j].d_name) == 0){
-                return (i * DENTRY_NUM_PER_BLOCK + j);     
-            }
-        }
-    }
-    return -1;
+    return scan_dir(inode_ptr, name);
 }
 
 // uint32_t parse_path(const char *path, inode_t *inode_ptr)
@@ -627,7 +803,13 @@ uint32_t parse_path(const char *path, inode_t *inode_ptr)
             parse_file_buffer[i] = '\0';
 
             inum = find_file(&_inode, _p);
-            sync_from_disk_inode(inum, &_inode);
+            if(inum == (uint32_t)-1){
+                return inum;
+            }
+            //the inode of the last component is not needed here
+            if(i + 1 < l){
+                sync_from_disk_inode(inum, &_inode);
+            }
 
             _p = &parse_file_buffer[i+1];
 
@@ -658,17 +840,9 @@ int find_free_inode()
 
 int find_free_block()
 {
-    int i = 0, j = 0;
-    for(; i < BLOCK_BITMAP_SIZE; i++){
-        if(blockbmp_buffer[i] != 0xff){
-            while(check_block_bmp(j) == 1){
-                j++;
-            }
-            return j;
-        }
-        else{
-            j += BYTE_SIZE;         
-        }
+    int block_index = next_free_block(alloc_cursor, BLOCK_NUM);
+    if(block_index >= 0 || (block_index = next_free_block(DATA_BLOCK_INDEX, alloc_cursor)) >= 0){
+        return block_index;
     }
     vt100_move_cursor(1, 45);
     printk("[FS ERROR] ERROR_NO_FREE_BLOCK\n");
@@ -678,6 +852,7 @@ int find_free_block()
 void release_inode_block(inode_t *inode_ptr)
 {
     uint32_t i, j, k;
+    bmap_forget(inode_ptr->i_num);
     bzero(buffer1, POINTER_PER_BLOCK*sizeof(uint32_t));
     bzero(buffer2, POINTER_PER_BLOCK*sizeof(uint32_t));
     bzero(buffer3, POINTER_PER_BLOCK*sizeof(uint32_t));
@@ -768,6 +943,8 @@ int is_empty_dnetry(dentry_t *dentry_ptr)
 //operations on file system
 void init_fs()
 {
+    bcache_init();
+    dcache_init();
     sync_from_disk_superblock();
 
     if(superblock_ptr->s_magic == FS_MAGIC_NUMBER){
@@ -819,6 +996,11 @@ void do_mkfs()
     bzero(parent_buffer, MAX_PATH_LENGTH);
     bzero(name_buffer, MAX_NAME_LENGTH);
 
+    blockbmp_dirty = (1 << BLOCK_BMP_BLOCKS_NUM) - 1;
+    count_free_blocks();
+    bmap_forget_all();
+    dcache_init();
+    alloc_cursor = DATA_BLOCK_INDEX;
     sync_to_disk_block_bmp();
     sync_to_disk_inode_bmp();
 
@@ -873,7 +1055,8 @@ void do_mkfs()
     root_inode_ptr->i_indirect_block_2_ptr = NULL;
     root_inode_ptr->i_indirect_block_3_ptr = NULL;
     root_inode_ptr->i_num = 0;
-    bzero(root_inode_ptr->padding, 10*sizeof(uint32_t));
+    bzero(root_inode_ptr->i_extent, INODE_EXTENT_NUM*sizeof(extent_t));
+    bzero(root_inode_ptr->padding, 1*sizeof(uint32_t));
     sync_to_disk_inode(root_inode_ptr);
 
     dentry_t *root_dentry_table = (dentry_t *)dentry_block_buffer;
@@ -952,9 +1135,6 @@ uint32_t do_mkdir(const char *path, mode_t mode)
     // parent_inum = parse_path(parent, current_dir_ptr);
     parent_inum = find_file(current_dir_ptr, parent_buffer);
     
-    sync_from_disk_block_bmp();
-    sync_from_disk_inode_bmp();
-
     inode_t parent_inode, new_inode;
     sync_from_disk_inode(parent_inum, &parent_inode);
 
@@ -969,14 +1149,9 @@ uint32_t do_mkdir(const char *path, mode_t mode)
     sync_to_disk_inode_bmp();
 
     superblock_ptr->s_free_inode_cnt--;
-    sync_to_disk_superblock();
-
-    free_block_index = find_free_block();
-    set_block_bmp(free_block_index);
-    sync_to_disk_block_bmp();
+    superblock_dirty = TRUE;
 
-    superblock_ptr->s_free_blocks_cnt--;
-    sync_to_disk_superblock();    
+    free_block_index = alloc_block();
 
     new_inode.i_fmode = S_IFDIR | mode;
     new_inode.i_links_cnt = 1;
@@ -991,7 +1166,8 @@ uint32_t do_mkdir(const char *path, mode_t mode)
     new_inode.i_indirect_block_2_ptr = NULL;
     new_inode.i_indirect_block_3_ptr = NULL;
     new_inode.i_num = free_inum;
-    bzero(new_inode.padding, 10*sizeof(uint32_t));
+    bzero(new_inode.i_extent, INODE_EXTENT_NUM*sizeof(extent_t));
+    bzero(new_inode.padding, 1*sizeof(uint32_t));
 
     sync_to_disk_inode(&new_inode);
 
@@ -1013,9 +1189,6 @@ uint32_t do_mkdir(const char *path, mode_t mode)
 
 void do_rmdir(const char *path)
 {
-    sync_from_disk_block_bmp();
-    sync_from_disk_inode_bmp();
-
     bzero(parent_buffer, MAX_PATH_LENGTH);
     bzero(path_buffer, MAX_PATH_LENGTH);
     bzero(name_buffer, MAX_NAME_LENGTH);
@@ -1044,6 +1217,7 @@ void do_rmdir(const char *path)
 
     release_inode_block(&child_inode);
     sync_to_disk_block_bmp();
+    dcache_forget_dir(child_inum);
 
     uint32_t dnum = find_dentry(&parent_inode, name_buffer);
     remove_dentry(&parent_inode, dnum);
@@ -1248,98 +1422,121 @@ int do_fopen(char *name, uint32_t mode)
     return j;
 }
 
-int do_fwrite(int fd, char *buffer, int length)
+static void set_file_block(inode_t *inode_ptr, uint32_t idx, uint32_t block_index)
 {
-    bzero(fwrite_buffer, FILE_READ_MAX_LENGTH);
-
-    uint32_t begin_block = file_descriptor_table[fd].fd_w_offset / BLOCK_SIZE;
-    uint32_t end_block = (file_descriptor_table[fd].fd_w_offset + length) / BLOCK_SIZE;
-
-    uint32_t block_need = end_block - begin_block;
-
-    inode_t inode;
-    sync_from_disk_inode(file_descriptor_table[fd].fd_inum, &inode);
-
-    // if(flag_first_write == 0){
-    if(file_descriptor_table[fd].fd_w_offset == 0){
-        int i = 0;
-        for(; i <= block_need; i++){
-            uint32_t free_index = find_free_block();
-
-            set_block_bmp(free_index);
-            sync_to_disk_block_bmp();
-
-            superblock_ptr->s_free_blocks_cnt--;
-            sync_to_disk_superblock();
+    if(idx < FIRST_POINTER){
+        inode_ptr->i_direct_table[idx] = block_index;
+    }
+    else{
+        write_block_index_in_inode(inode_ptr, idx, block_index);
+    }
+}
 
-            clear_block_index(free_index);
-            inode.i_indirect_block_1_ptr = free_index;
-            inode.i_fsize += BLOCK_SIZE;
+//n file blocks to or from buf, one card transfer per run of consecutive disk blocks; holes are skipped
+static void file_blocks_io(uint32_t *blocks, uint32_t n, uint8_t *buf, bool_t write)
+{
+    uint32_t i = 0, run;
 
-            //TO DO
-            inode.i_direct_table[begin_block + i] = free_index;
-            sync_to_disk_inode(&inode);
+    while(i < n){
+        if(blocks[i] == 0){
+            i++;
+            continue;
+        }
+        for(run = 1; i + run < n && blocks[i + run] == blocks[i] + run; run++)
+            ;
+        if(write){
+            bcache_write_run(blocks[i], run, buf + i * BLOCK_SIZE);
         }
+        else{
+            bcache_read_run(blocks[i], run, buf + i * BLOCK_SIZE);
+        }
+        i += run;
     }
-    else if(block_need != 0){
-        int i = 1;
-        for(; i <= block_need; i++){
-            uint32_t free_index = find_free_block();
+}
 
-            set_block_bmp(free_index);
-            sync_to_disk_block_bmp();
+int do_fwrite(int fd, char *buffer, int length)
+{
+    uint32_t offset = file_descriptor_table[fd].fd_w_offset;
+    uint32_t begin_block, end_block, n, i, j, k, got;
+    uint32_t blocks[FILE_WRITE_BLOCK_NUM + 1];
+    int start;
 
-            superblock_ptr->s_free_blocks_cnt--;
-            sync_to_disk_superblock();
+    if(length <= 0){
+        return 0;
+    }
+    if(length > FILE_WRITE_MAX_LENGTH){
+        length = FILE_WRITE_MAX_LENGTH;
+    }
+    begin_block = offset / BLOCK_SIZE;
+    end_block = (offset + length - 1) / BLOCK_SIZE;
+    n = end_block - begin_block + 1;
 
-            clear_block_index(free_index);
-            inode.i_indirect_block_1_ptr = free_index;
-            inode.i_fsize += BLOCK_SIZE;
+    bzero(fwrite_buffer, sizeof(fwrite_buffer));
 
-            //TO DO
-            inode.i_direct_table[begin_block + i] = free_index;
-            sync_to_disk_inode(&inode);
-        }
-    }
+    inode_t inode;
+    sync_from_disk_inode(file_descriptor_table[fd].fd_inum, &inode);
+    get_block_range_in_inode(&inode, begin_block, n, blocks);
 
-    uint32_t begin_block_index = get_block_index_in_inode(&inode, begin_block);
-    uint32_t end_block_index = get_block_index_in_inode(&inode, end_block);
+    //only the partly overwritten blocks at the ends need their old contents
+    if(blocks[0] != 0 && offset % BLOCK_SIZE != 0){
+        bcache_read_run(blocks[0], 1, fwrite_buffer);
+    }
+    if(blocks[n - 1] != 0 && (offset + length) % BLOCK_SIZE != 0 && (n > 1 || offset % BLOCK_SIZE == 0)){
+        bcache_read_run(blocks[n - 1], 1, fwrite_buffer + (n - 1) * BLOCK_SIZE);
+    }
 
-    int i = 0;
-    for(i = begin_block_index; i <= end_block_index; i++){
-        read_block(i, fwrite_buffer + (i - begin_block_index)*BLOCK_SIZE);
+    //each hole in the range is filled with as few extents as the free space allows
+    for(i = 0; i < n; i = j){
+        for(j = i; j < n && blocks[j] == 0; j++)
+            ;
+        while(i < j && (start = alloc_extent(j - i, &got)) >= 0){
+            inode_add_extent(&inode, begin_block + i, start, got);
+            for(k = 0; k < got; k++, i++){
+                blocks[i] = start + k;
+                set_file_block(&inode, begin_block + i, start + k);
+                inode.i_fsize += BLOCK_SIZE;
+            }
+        }
+        if(i < j){
+            //out of space, what did get blocks is still written
+            break;
+        }
+        j++;
     }
+    sync_to_disk_inode(&inode);
+    sync_to_disk_meta();
 
-    memcpy(fwrite_buffer + (file_descriptor_table[fd].fd_w_offset % BLOCK_SIZE), buffer, length);
+    memcpy(fwrite_buffer + (offset % BLOCK_SIZE), buffer, length);
+    file_blocks_io(blocks, n, fwrite_buffer, TRUE);
 
     file_descriptor_table[fd].fd_w_offset += length;
-
-    // int i = 0;
-    for(i = begin_block_index; i <= end_block_index; i++){
-        write_block(i, fwrite_buffer + (i - begin_block_index)*BLOCK_SIZE);
-    }
     return length;
 }
 
 int do_fread(int fd, char *buffer, int length)
 {
-    bzero(fread_buffer, FILE_READ_MAX_LENGTH);
+    uint32_t offset = file_descriptor_table[fd].fd_r_offset;
+    uint32_t begin_block, end_block, n;
+    uint32_t blocks[FILE_READ_BLOCK_NUM + 1];
+
+    if(length <= 0){
+        return 0;
+    }
+    if(length > FILE_READ_MAX_LENGTH){
+        length = FILE_READ_MAX_LENGTH;
+    }
+    begin_block = offset / BLOCK_SIZE;
+    end_block = (offset + length - 1) / BLOCK_SIZE;
+    n = end_block - begin_block + 1;
 
-    uint32_t begin_block = file_descriptor_table[fd].fd_r_offset / BLOCK_SIZE;
-    uint32_t end_block = (file_descriptor_table[fd].fd_r_offset + length) / BLOCK_SIZE;
+    bzero(fread_buffer, sizeof(fread_buffer));
 
     inode_t inode;
     sync_from_disk_inode(file_descriptor_table[fd].fd_inum, &inode);
+    get_block_range_in_inode(&inode, begin_block, n, blocks);
+    file_blocks_io(blocks, n, fread_buffer, FALSE);
 
-    uint32_t begin_block_index = get_block_index_in_inode(&inode, begin_block);
-    uint32_t end_block_index = get_block_index_in_inode(&inode, end_block);
-
-    int i = 0;
-    for(i = begin_block_index; i <= end_block_index; i++){
-        read_block(i, fread_buffer + (i - begin_block_index)*BLOCK_SIZE);
-    }
-
-    memcpy(buffer, fread_buffer + (file_descriptor_table[fd].fd_r_offset % BLOCK_SIZE), length);
+    memcpy(buffer, fread_buffer + (offset % BLOCK_SIZE), length);
 
     file_descriptor_table[fd].fd_r_offset += length;
 
@@ -1370,9 +1567,6 @@ int do_touch(char *name, mode_t mode)
     // parent_inum = parse_path(parent, current_dir_ptr);
     parent_inum = find_file(current_dir_ptr, parent_buffer);
     
-    sync_from_disk_block_bmp();
-    sync_from_disk_inode_bmp();
-
     inode_t parent_inode, new_inode;
     sync_from_disk_inode(parent_inum, &parent_inode);
 
@@ -1387,7 +1581,7 @@ int do_touch(char *name, mode_t mode)
     sync_to_disk_inode_bmp();
 
     superblock_ptr->s_free_inode_cnt--;
-    sync_to_disk_superblock();
+    superblock_dirty = TRUE;
 
     // new_inode.i_fmode = S_IFDIR | mode;
     new_inode.i_fmode = S_IFREG | mode;
@@ -1404,7 +1598,8 @@ int do_touch(char *name, mode_t mode)
     new_inode.i_indirect_block_2_ptr = NULL;
     new_inode.i_indirect_block_3_ptr = NULL;
     new_inode.i_num = free_inum;
-    bzero(new_inode.padding, 10*sizeof(uint32_t));
+    bzero(new_inode.i_extent, INODE_EXTENT_NUM*sizeof(extent_t));
+    bzero(new_inode.padding, 1*sizeof(uint32_t));
 
     sync_to_disk_inode(&new_inode);
 
@@ -1451,7 +1646,7 @@ int do_find(char *path, char *name)
 
     if(count_char_in_string(c, path_buffer) == 0){
         uint32_t inum;
-        if((inum = _find_file(_current_dir_ptr, name)) != -1){
+        if((inum = find_file(_current_dir_ptr, name)) != -1){
         // if((inum = find_dentry(_current_dir_ptr, name)) != -1){
             inode_t ino;
             sync_from_disk_inode(inum, &ino);
@@ -1460,20 +1655,20 @@ int do_find(char *path, char *name)
             return 1;
         }
         
-        // return (_find_file(_current_dir_ptr, name) != -1);
+        // return (find_file(_current_dir_ptr, name) != -1);
         return 0;
     }
     else if(count_char_in_string(c, path_buffer) == 1){
         separate_path(path_buffer, parent_buffer, name_buffer);
         uint32_t inum_1, inum_2;
-        if((inum_1 = _find_file(_current_dir_ptr, parent_buffer)) != -1){
+        if((inum_1 = find_file(_current_dir_ptr, parent_buffer)) != -1){
         // if((inum_1 = find_dentry(_current_dir_ptr, parent_buffer)) != -1){
 
             inode_t ino_1;
             sync_from_disk_inode(inum_1, &ino_1);
             memcpy((int8_t *)_current_dir_ptr, (int8_t *)&ino_1, sizeof(inode_t));
 
-            if((inum_2 = _find_file(_current_dir_ptr, name_buffer)) != -1){
+            if((inum_2 = find_file(_current_dir_ptr, name_buffer)) != -1){
             // if((inum_2 = find_dentry(_current_dir_ptr, name_buffer)) != -1){
 
                 inode_t ino_2;
@@ -1484,26 +1679,26 @@ int do_find(char *path, char *name)
             }            
         }
         return 0;
-        // return (_find_file(_current_dir_ptr, name) != -1);     
+        // return (find_file(_current_dir_ptr, name) != -1);     
     }
     else if(count_char_in_string(c, path_buffer) == 2){
         separate_path(path_buffer, parent_buffer, name_buffer);
         separate_path(parent_buffer, parent_buffer_1, parent_buffer_2);
         uint32_t inum_1, inum_2, inum_3;
 
-        if((inum_1 = _find_file(_current_dir_ptr, parent_buffer_1)) != -1){
+        if((inum_1 = find_file(_current_dir_ptr, parent_buffer_1)) != -1){
 
             inode_t ino_1;
             sync_from_disk_inode(inum_1, &ino_1);
             memcpy((int8_t *)_current_dir_ptr, (int8_t *)&ino_1, sizeof(inode_t));
 
-            if((inum_2 = _find_file(_current_dir_ptr, parent_buffer_2)) != -1){
+            if((inum_2 = find_file(_current_dir_ptr, parent_buffer_2)) != -1){
 
                 inode_t ino_2;
                 sync_from_disk_inode(inum_2, &ino_2);
                 memcpy((int8_t *)_current_dir_ptr, (int8_t *)&ino_2, sizeof(inode_t));
 
-                if((inum_3 = _find_file(_current_dir_ptr, name_buffer)) != -1){
+                if((inum_3 = find_file(_current_dir_ptr, name_buffer)) != -1){
 
                     inode_t ino_3;
                     sync_from_disk_inode(inum_3, &ino_3);
@@ -1612,9 +1807,6 @@ void do_symlink(char *src_path, char *new_path)
     // parent_inum = find_file(current_dir_ptr, parent_buffer);
     parent_inum = parse_path(new_path, current_dir_ptr);
     
-    sync_from_disk_block_bmp();
-    sync_from_disk_inode_bmp();
-
     inode_t parent_inode, new_inode;
     sync_from_disk_inode(parent_inum, &parent_inode);
 
@@ -1623,14 +1815,9 @@ void do_symlink(char *src_path, char *new_path)
     sync_to_disk_inode_bmp();
 
     superblock_ptr->s_free_inode_cnt--;
-    sync_to_disk_superblock();
+    superblock_dirty = TRUE;
 
-    free_block_index = find_free_block();
-    set_block_bmp(free_block_index);
-    sync_to_disk_block_bmp();
-
-    superblock_ptr->s_free_blocks_cnt--;
-    sync_to_disk_superblock();    
+    free_block_index = alloc_block();
 
     new_inode.i_fmode = S_IFLNK;
     new_inode.i_links_cnt = 1;
@@ -1645,7 +1832,8 @@ void do_symlink(char *src_path, char *new_path)
     new_inode.i_indirect_block_2_ptr = NULL;
     new_inode.i_indirect_block_3_ptr = NULL;
     new_inode.i_num = free_inum;
-    bzero(new_inode.padding, 10*sizeof(uint32_t));
+    bzero(new_inode.i_extent, INODE_EXTENT_NUM*sizeof(extent_t));
+    bzero(new_inode.padding, 1*sizeof(uint32_t));
 
     sync_to_disk_inode(&new_inode);
 
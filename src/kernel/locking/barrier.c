@@ -16,6 +16,7 @@ void do_barrier_wait(barrier_t *barrier)
     else{
         barrier->not_arrive_num--;
         current_running->status = TASK_BLOCKED;
+        current_running->blocked_queue = &(barrier->waiting_queue);
         queue_push(&(barrier->waiting_queue), current_running);
         do_scheduler();
     }
@@ -10,6 +10,7 @@ void do_condition_wait(mutex_lock_t *lock, condition_t *condition)
 {
     queue_push(&(condition->waiting_queue), current_running);
     current_running->status = TASK_BLOCKED;
+    current_running->blocked_queue = &(condition->waiting_queue);
     do_mutex_lock_release(lock);
     do_scheduler();
     do_mutex_lock_acquire(lock);
@@ -20,7 +21,7 @@ void do_condition_signal(condition_t *condition)
     if(!queue_is_empty(&(condition->waiting_queue))){
         pcb_t *pcb = queue_dequeue(&(condition->waiting_queue));
         pcb->status = TASK_READY;
-        queue_push(&ready_queue, pcb);
+        ready_queue_push(pcb);
     }
 }
 
@@ -29,6 +30,6 @@ void do_condition_broadcast(condition_t *condition)
     while(!queue_is_empty(&(condition->waiting_queue))){
         pcb_t *pcb = queue_dequeue(&(condition->waiting_queue));
         pcb->status = TASK_READY;
-        queue_push(&ready_queue, pcb);
+        ready_queue_push(pcb);
     }
 }
\ No newline at end of file
@@ -12,7 +12,7 @@ void do_semaphore_up(semaphore_t *s)
     if(!queue_is_empty(&(s->waiting_queue))){
         pcb_t *pcb = queue_dequeue(&(s->waiting_queue));
         pcb->status = TASK_READY;
-        queue_push(&ready_queue, pcb);
+        ready_queue_push(pcb);
     }
     else{
         s->sem_value++;
@@ -23,6 +23,7 @@ void do_semaphore_down(semaphore_t *s)
 {
     if(s->sem_value == 0){
         current_running->status = TASK_BLOCKED;
+        current_running->blocked_queue = &(s->waiting_queue);
         queue_push(&(s->waiting_queue), current_running);
         do_scheduler();
     }
@@ -0,0 +1,174 @@
+#include "kmalloc.h"
+#include "mm.h"
+#include "string.h"
+#include "stdio.h"
+
+/*
+ * kernel heap: small requests are served from per-class free lists carved out
+ * of whole page frames, large ones take contiguous frames straight from page_map.
+ * pages of a size class are kept once carved, so a class only grows to its peak.
+ */
+
+#define KMALLOC_LARGE  KMALLOC_NUM_CLASSES
+#define KMALLOC_NONE   0xff
+
+typedef struct kmalloc_block {
+    struct kmalloc_block *next;
+} kmalloc_block_t;
+
+kmalloc_stat_t KmallocStat[KMALLOC_NUM_CLASSES + 1];
+
+static kmalloc_block_t *free_list[KMALLOC_NUM_CLASSES];
+
+/* owner of every frame: a size class, KMALLOC_LARGE for the head of a multi-frame block, or KMALLOC_NONE */
+static uint8_t frame_class[FRAME_PAGES];
+static uint16_t frame_npages[FRAME_PAGES];
+
+void init_kmalloc()
+{
+    int i;
+
+    init_page_map();
+
+    for(i = 0; i < KMALLOC_NUM_CLASSES; i++){
+        free_list[i] = NULL;
+    }
+    for(i = 0; i < FRAME_PAGES; i++){
+        frame_class[i] = KMALLOC_NONE;
+        frame_npages[i] = 0;
+    }
+    bzero(KmallocStat, sizeof(KmallocStat));
+    for(i = 0; i < KMALLOC_NUM_CLASSES; i++){
+        KmallocStat[i].size = 1 << (i + KMALLOC_MIN_SHIFT);
+    }
+}
+
+static int size_to_class(uint32_t size)
+{
+    int shift = KMALLOC_MIN_SHIFT;
+    while((1 << shift) < size){
+        shift++;
+    }
+    return shift - KMALLOC_MIN_SHIFT;
+}
+
+/* carve a fresh frame into blocks of one class */
+static int class_refill(int class)
+{
+    uint32_t size = 1 << (class + KMALLOC_MIN_SHIFT);
+    uint32_t page = kpage_alloc(1);
+    uint32_t addr;
+    kmalloc_block_t *block;
+
+    if(page == 0){
+        return 0;
+    }
+    frame_class[(page - PAGE_FRAME_START) / PAGE_SIZE] = class;
+
+    for(addr = page + PAGE_SIZE - size; addr >= page; addr -= size){
+        block = (kmalloc_block_t *)addr;
+        block->next = free_list[class];
+        free_list[class] = block;
+        if(addr == page){
+            break;
+        }
+    }
+    KmallocStat[class].pages++;
+    KmallocStat[class].free += PAGE_SIZE >> (class + KMALLOC_MIN_SHIFT);
+    return 1;
+}
+
+static void *kmalloc_large(uint32_t size)
+{
+    int npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t page = kpage_alloc(npages);
+    int index;
+
+    if(page == 0){
+        KmallocStat[KMALLOC_LARGE].fail_count++;
+        return NULL;
+    }
+    index = (page - PAGE_FRAME_START) / PAGE_SIZE;
+    frame_class[index] = KMALLOC_LARGE;
+    frame_npages[index] = npages;
+
+    KmallocStat[KMALLOC_LARGE].pages += npages;
+    KmallocStat[KMALLOC_LARGE].in_use++;
+    KmallocStat[KMALLOC_LARGE].alloc_count++;
+    return (void *)page;
+}
+
+void *kmalloc(uint32_t size)
+{
+    int class;
+    kmalloc_block_t *block;
+
+    if(size == 0){
+        return NULL;
+    }
+    if(size > KMALLOC_MAX_SIZE){
+        return kmalloc_large(size);
+    }
+
+    class = size_to_class(size);
+    if(free_list[class] == NULL && !class_refill(class)){
+        KmallocStat[class].fail_count++;
+        return NULL;
+    }
+    block = free_list[class];
+    free_list[class] = block->next;
+
+    KmallocStat[class].free--;
+    KmallocStat[class].in_use++;
+    KmallocStat[class].alloc_count++;
+    return (void *)block;
+}
+
+void *kzalloc(uint32_t size)
+{
+    void *ptr = kmalloc(size);
+    if(ptr != NULL){
+        bzero(ptr, size);
+    }
+    return ptr;
+}
+
+void kfree(void *ptr)
+{
+    uint32_t addr = (uint32_t)ptr;
+    int index, class;
+    kmalloc_block_t *block;
+
+    if(ptr == NULL){
+        return;
+    }
+    if(addr < PAGE_FRAME_START || addr >= PAGE_FRAME_START + FRAME_SIZE){
+        printk("[KMALLOC] kfree: bad pointer %x\n", addr);
+        return;
+    }
+
+    index = (addr - PAGE_FRAME_START) / PAGE_SIZE;
+    class = frame_class[index];
+    if(class == KMALLOC_NONE){
+        printk("[KMALLOC] kfree: %x is not a heap block\n", addr);
+        return;
+    }
+
+    if(class == KMALLOC_LARGE){
+        KmallocStat[KMALLOC_LARGE].pages -= frame_npages[index];
+        KmallocStat[KMALLOC_LARGE].in_use--;
+        KmallocStat[KMALLOC_LARGE].free_count++;
+        kpage_free(addr, frame_npages[index]);
+        frame_class[index] = KMALLOC_NONE;
+        frame_npages[index] = 0;
+        return;
+    }
+
+    block = (kmalloc_block_t *)addr;
+    block->next = free_list[class];
+    free_list[class] = block;
+
+    KmallocStat[class].free++;
+    KmallocStat[class].in_use--;
+    KmallocStat[class].free_count++;
+}
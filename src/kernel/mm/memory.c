@@ -29,6 +29,12 @@
 #include "sched.h"
 #include "test.h"
 #include "sem.h"
+#include "kmalloc.h"
+#include "trace.h"
+#include "irq.h"
+#include "syscall.h"
+#include "bitmap.h"
+#include "vma.h"
 
 //TODO:Finish memory management functions here refer to mm.h and add any functions you need.
 
@@ -36,14 +42,11 @@
 //global pointer to the level one page table base address
 // page_directory_entry_t page_dir[PAGE_DIR_ENTRIES];
 
-// Keep track of all page frames (in memory and in swap division): their vaddr, status, and other properties
-static page_map_entry_t page_map[PAGEABLE_PAGES];
+// Keep track of all page frames in memory: their vaddr, owner, status, and other properties
+static page_map_entry_t page_map[FRAME_PAGES];
 
-// Keep track of all units in swap divsion: their status, and other properties
-static swap_map_entry_t swap_table[SD_SWAP_UNIT_NUM];
-
-//global page table pointer
-uint32_t page_table_base_ptr = 0;
+// one bit per unit of the swap division, set while a page lives there
+static uint8_t swap_bitmap[SD_SWAP_UNIT_NUM / 8];
 
 //global page frame pointer (only in memory!!!)
 uint32_t page_frame_base_ptr = PAGE_FRAME_START;
@@ -55,21 +58,48 @@ uint32_t vm_base_ptr = 0;
 
 tlb_entry_t tlb_table[TLB_ENTRIES_NUM];
 
-static int tlb_entry_index_ptr = 0;
-
 // extern int page_alloc_ptr;
 static int page_alloc_ptr = 0;
 
 static int swap_page_alloc_ptr = 0;
 
-static uint32_t wrong_pid;
+//clock hand of the replacer, walks page_map[0 .. FRAME_PAGES)
+static int clock_ptr = 0;
 
-int tlb_refill_count = 0;
+int tlb_refill_count = 0;    // every refill exception, counted by the refill vector
 int tlb_invalid_count = 0;
-
+uint32_t tlb_refill_fast_enabled = 1;
+
+int page_evict_count = 0;     // frames taken back by the clock
+int page_writeback_count = 0; // ... of which had to be written to swap first
+int page_swapin_count = 0;
+int page_readahead_count = 0;     // neighbours read in along with a faulting page
+int page_direct_reclaim_count = 0; // evictions a faulting task had to wait for
+int page_zero_map_count = 0;       // first touches that were loads and got the zero page
+int page_cow_count = 0;            // stores that had to copy a shared frame
+int tlb_large_count = 0;           // large-page entries written
+int swapd_reclaim_count = 0;       // frames freed in the background by swapd
+
+//swapd sleeps on it, the fault path ups it once free frames drop under the low watermark
 static semaphore_t sem_swap;
+static bool_t swapd_wakeup_pending = FALSE;
+
+//SWAP_BATCH pages of staging, so a run of units goes to or from the SD card in one request
+static uint8_t *swap_buffer = NULL;
+
+static bool_t page_map_ready = FALSE;
+
+//the shared, always zero frame every first-touch load maps read-only
+static int zero_page_index = -1;
 
-static uint32_t swap_buffer_addr = 0x1800000;
+//user regions backed by contiguous frames and mapped with large TLB entries, size 0 if unused
+static vm_large_t vm_large[VM_LARGE_MAX];
+
+//large page sizes tried by vm_map_large, biggest first
+static const uint32_t large_page_size[] = {0x1000000, 0x100000, 0x10000};
+
+//TLB slots [0, TLB_WIRED_MAX) handed out by vm_wire, CP0_Wired covers up to the highest one in use
+static tlb_wired_t tlb_wired[TLB_WIRED_MAX];
 
 /* get the physical address from virtual address (in kernel) */
 static uint32_t va_2_pa(uint32_t va) 
@@ -94,188 +124,704 @@ static uint32_t page_frame_paddr(uint32_t index)
     return va_2_pa(page_frame_vaddr(index));
 }
 
-static uint32_t get_swap_free_index()
+/* page_map index of the frame a present PTE points to */
+static int pte_frame_index(uint32_t pte)
+{
+    return (pte >> 6) - (page_frame_paddr(0) >> 12);
+}
+
+static uint32_t swap_unit_offset(int slot)
 {
-    int i = swap_page_alloc_ptr;
-    while(i < SD_SWAP_UNIT_NUM && page_map[i + FRAME_PAGES].avail == 0){
-        i = (i + 1) % SD_SWAP_UNIT_NUM;
+    return SD_SWAP_DIVISION_START + slot * SD_SWAP_UNIT;
+}
+
+/* take npages consecutive free units of the swap division, next fit; -1 if there is no such run */
+static int get_swap_free_run(int npages)
+{
+    int slot, i;
+
+    slot = find_zero_run_bitmap(swap_bitmap, swap_page_alloc_ptr, SD_SWAP_UNIT_NUM, npages);
+    if(slot < 0){
+        slot = find_zero_run_bitmap(swap_bitmap, 0, SD_SWAP_UNIT_NUM, npages);
     }
-    // page_map[i + FRAME_PAGES].avail = 0;
-    swap_page_alloc_ptr = i;
-    return i;   
+    if(slot < 0){
+        return -1;
+    }
+    for(i = 0; i < npages; i++){
+        set_bitmap(swap_bitmap, slot + i);
+    }
+    swap_page_alloc_ptr = (slot + npages) % SD_SWAP_UNIT_NUM;
+    return slot;
 }
 
-static uint32_t get_swap_in_index(bool_t swapin_valid)
+static int get_swap_free_index()
 {
-    if(swapin_valid == 0){
-        return get_swap_free_index();      
+    return get_swap_free_run(1);
+}
+
+static void swap_free_index(int slot)
+{
+    if(slot >= 0 && slot < SD_SWAP_UNIT_NUM){
+        unset_bitmap(swap_bitmap, slot);
+    }
+}
+
+static void tlb_sync_pair(uint32_t vaddr, uint32_t asid, uint32_t *pte);
+static void tlb_wired_release(int slot);
+static uint32_t *pte_lookup(pcb_t *pcb, uint32_t vaddr, bool_t alloc);
+
+/* 
+ * the PTE that maps a user frame, NULL if its recorded owner is gone or no 
+ * longer maps it there (the owner broke a copy-on-write share and another 
+ * sharer is left; that one takes the frame over on its next fault).
+ */
+static uint32_t *frame_pte(page_map_entry_t *frame, pcb_t **owner)
+{
+    uint32_t *pte;
+
+    *owner = get_pcb_by_pid(frame->pid);
+    if(*owner == NULL){
+        return NULL;
+    }
+    pte = pte_lookup(*owner, frame->vaddr, FALSE);
+    if(pte == NULL || *pte == 0 || (*pte & PTE_SWAPPED) || pte_frame_index(*pte) != frame->index){
+        return NULL;
+    }
+    return pte;
+}
+
+/*
+ * WSClock over the user frames. a PTE is kept invalid until the page is
+ * touched, so V doubles as the hardware reference bit: the hand clears it
+ * (and drops the TLB copy) to give the page a second chance, the next
+ * access comes back through handle_tlb and sets it again. D is left clear
+ * until the first store, so clean pages are preferred as victims and dirty
+ * ones only go once a couple of laps found nothing clean.
+ */
+static int clock_select()
+{
+    page_map_entry_t *frame;
+    uint32_t *pte;
+    pcb_t *owner;
+    int scanned;
+
+    for(scanned = 0; scanned < 3 * FRAME_PAGES; scanned++){
+        frame = &page_map[clock_ptr];
+        clock_ptr = (clock_ptr + 1) % FRAME_PAGES;
+
+        //a shared frame has more PTEs than page_map can name, it stays until the sharing ends
+        if(frame->avail == 1 || frame->pinned == 1 || frame->share > 1){
+            continue;
+        }
+        pte = frame_pte(frame, &owner);
+        if(pte == NULL){
+            continue;
+        }
+        if(*pte & PTE_V){
+            *pte &= ~PTE_V;
+            frame->R = 0;
+            tlb_sync_pair(frame->vaddr, owner->asid, pte);
+            continue;
+        }
+        if(frame->dirty == 1 && scanned < 2 * FRAME_PAGES){
+            continue;
+        }
+        return frame->index;
+    }
+    return -1;
+}
+
+/* unmap a victim frame, writing it to swap only if it changed since it was last there */
+static int page_evict(int index)
+{
+    page_map_entry_t *frame = &page_map[index];
+    uint32_t *pte;
+    pcb_t *owner;
+
+    pte = frame_pte(frame, &owner);
+    if(frame->dirty == 1){
+        if(frame->swap_index < 0 && (frame->swap_index = get_swap_free_index()) < 0){
+            printk("[MM] swap division is full\n");
+            return 0;
+        }
+        sdwrite((unsigned char *)page_frame_vaddr(index), swap_unit_offset(frame->swap_index), PAGE_SIZE);
+        page_writeback_count++;
+    }
+
+    if(pte != NULL){
+        //never stored to since it was zero filled: the next touch just gets a new zero page
+        *pte = (frame->swap_index < 0) ? 0 : (PTE_SWAPPED | frame->swap_index);
+        tlb_sync_pair(frame->vaddr, owner->asid, pte);
     }
     else{
+        swap_free_index(frame->swap_index);
+    }
+
+    frame->avail      = 1;
+    frame->dirty      = 0;
+    frame->R          = 0;
+    frame->pid        = 0;
+    frame->share      = 0;
+    frame->swap_index = -1;
+    free_page_frame_num++;
+    page_evict_count++;
+    return 1;
+}
+
+static int frame_alloc_free()
+{
+    int i, j;
+
+    for(j = 0; j < FRAME_PAGES; j++){
+        i = (page_alloc_ptr + j) % FRAME_PAGES;
+        if(page_map[i].avail == 1){
+            page_alloc_ptr = (i + 1) % FRAME_PAGES;
+            return i;
+        }
+    }
+    return -1;
+}
 
+/* hand frame index to current_running at vaddr, and wake swapd if free frames run low */
+static void frame_assign(int index, uint32_t vaddr, bool_t pinned)
+{
+    page_map[index].vaddr      = vaddr & 0xfffff000;
+    page_map[index].VPN        = ((vaddr & 0xfffff000) >> 12);
+    page_map[index].pid        = current_running->pid;
+    page_map[index].avail      = 0;
+    page_map[index].pinned     = pinned;
+    page_map[index].dirty      = 0;
+    page_map[index].R          = 1;
+    page_map[index].share      = 1;
+    page_map[index].swap_index = -1;
+
+    if(free_page_frame_num > 0){
+        free_page_frame_num--;
+    }
+    if(free_page_frame_num < SWAP_LOW_WATERMARK && !swapd_wakeup_pending){
+        swapd_wakeup_pending = TRUE;
+        do_semaphore_up(&sem_swap);
     }
 }
 
-static void do_page_swap(uint32_t swap_out_index, uint32_t swap_in_index)
+//Page Fault handler: a frame for current_running at vaddr, -1 if none can be freed
+static int page_alloc(uint32_t vaddr, bool_t pinned)
 {
+    int free_index = frame_alloc_free();
 
+    if(free_index < 0){
+        free_index = clock_select();
+        if(free_index < 0 || !page_evict(free_index)){
+            return -1;
+        }
+        page_direct_reclaim_count++;
+    }
+    frame_assign(free_index, vaddr, pinned);
+    return free_index;
 }
 
-void swap_process()
+/*
+ * read a swapped page back into frame index. the pages right after it that 
+ * were clustered into the following units come along in the same SD read, 
+ * mapped but unreferenced, as long as there are free frames to spare.
+ */
+static void swap_in(int index, uint32_t vaddr, int slot)
 {
+    int ahead[SWAP_READAHEAD];
+    uint32_t *pte;
+    int n, k;
 
+    for(n = 1; n < SWAP_READAHEAD && free_page_frame_num > SWAP_LOW_WATERMARK; n++){
+        pte = pte_lookup(current_running, vaddr + n * PAGE_SIZE, FALSE);
+        if(pte == NULL || *pte != (PTE_SWAPPED | (slot + n)) || (ahead[n] = frame_alloc_free()) < 0){
+            break;
+        }
+        frame_assign(ahead[n], vaddr + n * PAGE_SIZE, 0);
+        page_map[ahead[n]].R = 0;
+        page_map[ahead[n]].swap_index = slot + n;
+        *pte = (page_map[ahead[n]].PFN << 6) | PTE_C;
+    }
+
+    if(n == 1){
+        sdread((unsigned char *)page_frame_vaddr(index), swap_unit_offset(slot), PAGE_SIZE);
+    }
+    else{
+        sdread(swap_buffer, swap_unit_offset(slot), n * PAGE_SIZE);
+        memcpy((uint8_t *)page_frame_vaddr(index), swap_buffer, PAGE_SIZE);
+        for(k = 1; k < n; k++){
+            memcpy((uint8_t *)page_frame_vaddr(ahead[k]), swap_buffer + k * PAGE_SIZE, PAGE_SIZE);
+        }
+    }
+    page_map[index].swap_index = slot;
+    page_swapin_count++;
+    page_readahead_count += n - 1;
 }
 
-//Page Fault handler
-static uint32_t page_alloc(bool_t pinned, bool_t swapin_valid, bool_t tlb_invalid)
+/* 
+ * the dirty, unreferenced pages that follow frame index in its owner's address 
+ * space and have no swap unit yet, so they can go out next to it. returns how 
+ * many frames (index included) were put in cluster.
+ */
+static int swapd_gather_cluster(int index, int *cluster, int max)
 {
-    int free_index;
-    int swap_out_index, swap_in_index;
-    bool_t flag_find_free_page = 0;
-    static int clock_ptr = 0;
-    int i;
-    for(i = page_alloc_ptr; i < FRAME_PAGES; i++){
-    // for(i = 0; i < FRAME_PAGES; i++){
-        if(page_map[i].avail == 1){
-            flag_find_free_page = 1;
-            free_index = i;
+    page_map_entry_t *frame = &page_map[index];
+    pcb_t *owner = get_pcb_by_pid(frame->pid);
+    uint32_t *pte;
+    int n, next;
+
+    cluster[0] = index;
+    for(n = 1; n < max && owner != NULL; n++){
+        pte = pte_lookup(owner, frame->vaddr + n * PAGE_SIZE, FALSE);
+        if(pte == NULL || *pte == 0 || (*pte & (PTE_SWAPPED | PTE_V))){
+            break;
+        }
+        next = pte_frame_index(*pte);
+        if(page_map[next].pinned || page_map[next].share > 1 || page_map[next].pid != frame->pid
+           || !page_map[next].dirty || page_map[next].swap_index >= 0){
+            break;
+        }
+        cluster[n] = next;
+    }
+    return n;
+}
+
+/*
+ * one round of background reclaim, run with interrupts off so the page tables 
+ * and page_map do not change under it. clean victims are dropped on the spot,
+ * dirty ones are staged in swap_buffer together with their dirty neighbours
+ * and written in runs of consecutive units before they are unmapped. 
+ * returns the number of frames freed.
+ */
+static int swapd_reclaim_batch()
+{
+    int victim[SWAP_BATCH], cluster[SWAP_BATCH];
+    int n = 0, freed = 0;
+    int i, run, index, len, slot;
 
-            page_alloc_ptr = (page_alloc_ptr + 1) % FRAME_PAGES;
-            
-            //BUG!!!!!!!!!!!!!!!!!!
+    while(n < SWAP_BATCH && free_page_frame_num + n < SWAP_HIGH_WATERMARK){
+        index = clock_select();
+        if(index < 0){
             break;
+        }
+        if(page_map[index].dirty == 0){
+            freed += page_evict(index);
+            continue;
+        }
+        if(page_map[index].swap_index >= 0){
+            //pinned so the hand cannot pick it twice in one batch
+            page_map[index].pinned = 1;
+            memcpy(swap_buffer + n * PAGE_SIZE, (uint8_t *)page_frame_vaddr(index), PAGE_SIZE);
+            victim[n++] = index;
+            continue;
+        }
 
-            // return free_index;
+        //no swap copy yet: take its virtual neighbours along into adjacent units
+        len = swapd_gather_cluster(index, cluster, SWAP_BATCH - n);
+        while(len > 0 && (slot = get_swap_free_run(len)) < 0){
+            len--;
+        }
+        if(len == 0){
+            printk("[MM] swap division is full\n");
+            break;
+        }
+        for(i = 0; i < len; i++){
+            page_map[cluster[i]].swap_index = slot + i;
+            page_map[cluster[i]].pinned = 1;
+            memcpy(swap_buffer + n * PAGE_SIZE, (uint8_t *)page_frame_vaddr(cluster[i]), PAGE_SIZE);
+            victim[n++] = cluster[i];
         }
     }
 
-    if(flag_find_free_page == 0){
-        while(page_map[clock_ptr].pinned == 1 || page_map[clock_ptr].R == 1){
-            if(page_map[clock_ptr].R == 1){
-                page_map[clock_ptr].R = 0;
+    for(i = 0; i < n; i += run){
+        for(run = 1; i + run < n; run++){
+            if(page_map[victim[i + run]].swap_index != page_map[victim[i]].swap_index + run){
+                break;
+            }
+        }
+        sdwrite(swap_buffer + i * PAGE_SIZE, swap_unit_offset(page_map[victim[i]].swap_index), run * PAGE_SIZE);
+    }
+
+    for(i = 0; i < n; i++){
+        index = victim[i];
+        page_map[index].pinned = 0;
+        page_map[index].dirty  = 0;
+        page_writeback_count++;
+        freed += page_evict(index);
+    }
+    return freed;
+}
+
+/* swapd: keeps free_page_frame_num between the watermarks so faults rarely wait for the SD card */
+void swap_process()
+{
+    uint32_t cp0_status;
+    int freed;
+
+    while(1){
+        semaphore_down(&sem_swap);
+
+        do{
+            cp0_status = get_cp0_status();
+            set_cp0_status(cp0_status & 0xfffffffe);
+            freed = swapd_reclaim_batch();
+            swapd_reclaim_count += freed;
+            if(freed == 0 || free_page_frame_num >= SWAP_HIGH_WATERMARK){
+                swapd_wakeup_pending = FALSE;
             }
-            clock_ptr = (clock_ptr + 1) % FRAME_PAGES;
-        }
-        
-        swap_out_index = clock_ptr;
-        swap_in_index = get_swap_in_index(swapin_valid) + FRAME_PAGES;
-
-        //swap in page is empty, tlb invalid
-        if(swapin_valid == 0 && tlb_invalid == 1){
-            //revised swap_out/swap_in PFN accordingly
-            page_map[swap_out_index].swaped     = 1;
-            // page_map[swap_out_index].swap_index = get_swap_free_index();
-            page_map[swap_out_index].swap_index = swap_in_index;
-
-            page_map[swap_in_index].pinned      = pinned;
-            page_map[swap_in_index].vaddr       = get_cp0_badvaddr();
-            page_map[swap_in_index].VPN         = ((get_cp0_badvaddr() & 0xfffff000) >> 12);
-            page_map[swap_in_index].index       = clock_ptr;
-            page_map[swap_in_index].paddr       = page_frame_paddr(clock_ptr);
-            page_map[swap_in_index].PFN         = ((page_map[swap_in_index].paddr & 0xfffff000) >> 12);
-            page_map[swap_in_index].pid         = current_running->pid;
-            page_map[swap_in_index].avail       = 0;
-            page_map[swap_in_index].R           = 1;
-            page_map[swap_in_index].swaped      = 0;            
-
-            uint32_t pid_out = page_map[swap_out_index].pid;
-            uint32_t VPN2_out = page_map[swap_out_index].vaddr & 0xffffe000;
-            uint32_t pid_in = page_map[swap_in_index].pid;
-            uint32_t VPN2_in = page_map[swap_in_index].vaddr & 0xffffe000;
-            uint32_t *page_table = (uint32_t *)page_table_base_ptr;
-
-            //revised swap_out/swap_in PTE accordingly
-            
-            
-        
-        }
-        //swap in page is not empty, tlb invalid
-        else if(swapin_valid == 1 && tlb_invalid == 1){
-            
-        }
-        //swap in page is empty, tlb refill
-        else if(swapin_valid == 0 && tlb_invalid == 0){
-            //revised swap_out/swap_in PFN accordingly
-            page_map[swap_out_index].swaped     = 1;
-            // page_map[swap_out_index].swap_index = get_swap_free_index();
-            page_map[swap_out_index].swap_index = swap_in_index;
-
-            page_map[swap_in_index].pinned      = pinned;
-            page_map[swap_in_index].vaddr       = get_cp0_badvaddr();
-            page_map[swap_in_index].VPN         = ((get_cp0_badvaddr() & 0xfffff000) >> 12);
-            page_map[swap_in_index].index       = clock_ptr;
-            page_map[swap_in_index].paddr       = page_frame_paddr(clock_ptr);
-            page_map[swap_in_index].PFN         = ((page_map[swap_in_index].paddr & 0xfffff000) >> 12);
-            page_map[swap_in_index].pid         = current_running->pid;
-            page_map[swap_in_index].avail       = 0;
-            page_map[swap_in_index].R           = 1;
-            page_map[swap_in_index].swaped      = 0;         
-
-            uint32_t pid_out = page_map[swap_out_index].pid;
-            uint32_t VPN2_out = page_map[swap_out_index].vaddr & 0xffffe000;
-            uint32_t pid_in = page_map[swap_in_index].pid;
-            uint32_t VPN2_in = page_map[swap_in_index].vaddr & 0xffffe000;
-            uint32_t *page_table = (uint32_t *)page_table_base_ptr;
-
-            //revised swap_out/swap_in PTE accordingly
-
-            
-
-        }
-        //swap in page is not empty, tlb refill
-        else if(swapin_valid == 1 && tlb_invalid == 0){
+            set_cp0_status(cp0_status);
+        }while(freed != 0 && free_page_frame_num < SWAP_HIGH_WATERMARK);
+    }
+}
+
+/* 
+ * per-process two-level page table: a one page directory indexed by vaddr[31:22] 
+ * holds the kernel addresses of one page tables indexed by vaddr[21:12]. 
+ * both levels come from kpage_alloc on first touch. PTEs are kept in EntryLo 
+ * layout, so an even/odd pair can be written to the TLB as is.
+ */
+static uint32_t *table_alloc()
+{
+    uint32_t *table = (uint32_t *)kpage_alloc(1);
+    if(table != NULL){
+        bzero(table, PAGE_SIZE);
+    }
+    return table;
+}
+
+static uint32_t *pte_lookup(pcb_t *pcb, uint32_t vaddr, bool_t alloc)
+{
+    uint32_t *dir = (uint32_t *)pcb->page_table_base_addr;
+    uint32_t *table;
 
+    if(dir == NULL){
+        if(!alloc || (dir = table_alloc()) == NULL){
+            return NULL;
+        }
+        pcb->page_table_base_addr = (uint32_t)dir;
+    }
+
+    table = (uint32_t *)dir[PGDIR_INDEX(vaddr)];
+    if(table == NULL){
+        if(!alloc || (table = table_alloc()) == NULL){
+            return NULL;
+        }
+        dir[PGDIR_INDEX(vaddr)] = (uint32_t)table;
+    }
+    return &table[PGTABLE_INDEX(vaddr)];
+}
+
+/* drop one PTE: its swap unit, its share of a frame, or the frame itself */
+static void pte_release(uint32_t *pte)
+{
+    int index;
+
+    if(*pte & PTE_SWAPPED){
+        swap_free_index(*pte & ~PTE_SWAPPED);
+    }
+    else if(*pte != 0){
+        index = pte_frame_index(*pte);
+        if(index == zero_page_index){
+            //shared by everyone, never freed
+        }
+        else if(page_map[index].share > 1){
+            page_map[index].share--;
         }
         else{
+            swap_free_index(page_map[index].swap_index);
+            page_map[index].avail      = 1;
+            page_map[index].pinned     = 0;
+            page_map[index].dirty      = 0;
+            page_map[index].R          = 0;
+            page_map[index].pid        = 0;
+            page_map[index].share      = 0;
+            page_map[index].swap_index = -1;
+            free_page_frame_num++;
+        }
+    }
+    *pte = 0;
+}
+
+/* 
+ * unmap [start, end) of pcb (page aligned): frames and swap units go back to 
+ * their pools, cached TLB pairs are invalidated, and large regions and wired 
+ * pairs inside it are dropped. the page tables stay.
+ */
+void vm_release_range(pcb_t *pcb, uint32_t start, uint32_t end)
+{
+    uint32_t *dir = (uint32_t *)pcb->page_table_base_addr;
+    uint32_t *table;
+    uint32_t va;
+    int i;
+
+    for(va = start; dir != NULL && va < end && va < VM_SIZE; ){
+        table = (uint32_t *)dir[PGDIR_INDEX(va)];
+        if(table == NULL){
+            va = (PGDIR_INDEX(va) + 1) << PGDIR_SHIFT;
+            continue;
+        }
+        pte_release(&table[PGTABLE_INDEX(va)]);
+        if((va & PAGE_SIZE) || va + PAGE_SIZE >= end){
+            tlb_sync_pair(va, pcb->asid, &table[PGTABLE_INDEX(va)]);
+        }
+        va += PAGE_SIZE;
+    }
+
+    for(i = 0; i < VM_LARGE_MAX; i++){
+        if(vm_large[i].size != 0 && vm_large[i].pid == pcb->pid
+           && vm_large[i].vaddr >= start && vm_large[i].vaddr + vm_large[i].size <= end){
+            vm_large[i].size = 0;
+        }
+    }
+    for(i = 0; i < TLB_WIRED_MAX; i++){
+        if(tlb_wired[i].used && tlb_wired[i].pid == pcb->pid
+           && tlb_wired[i].vaddr + 2 * PAGE_SIZE > start && tlb_wired[i].vaddr < end){
+            tlb_wired_release(i);
+        }
+    }
+}
 
+/* 1 if [start, end) cuts through a large region of pcb, which can only go as a whole */
+int vm_large_split(pcb_t *pcb, uint32_t start, uint32_t end)
+{
+    int i;
+    for(i = 0; i < VM_LARGE_MAX; i++){
+        if(vm_large[i].size != 0 && vm_large[i].pid == pcb->pid
+           && vm_large[i].vaddr < end && vm_large[i].vaddr + vm_large[i].size > start
+           && (vm_large[i].vaddr < start || vm_large[i].vaddr + vm_large[i].size > end)){
+            return 1;
         }
+    }
+    return 0;
+}
 
-        //flush swap_out/swap_in TLB accordingly
+/* give back every frame and table of an exiting process, and its TLB entries */
+void free_page_table(pcb_t *pcb)
+{
+    uint32_t *dir = (uint32_t *)pcb->page_table_base_addr;
+    uint32_t *table;
+    int i, j;
 
-        do_page_swap(swap_out_index, swap_in_index);
+    vma_free_all(pcb);
 
-        page_map[swap_out_index].swaped = 1;
-        page_map[swap_in_index].swaped = 0;
+    if(dir == NULL){
+        return;
+    }
+    for(i = 0; i < PGDIR_ENTRIES_NUM; i++){
+        table = (uint32_t *)dir[i];
+        if(table == NULL){
+            continue;
+        }
+        for(j = 0; j < PGTABLE_ENTRIES_NUM; j++){
+            pte_release(&table[j]);
+        }
+        kpage_free((uint32_t)table, 1);
+    }
+    kpage_free((uint32_t)dir, 1);
+    pcb->page_table_base_addr = 0;
 
-        free_index = swap_in_index;
+    for(i = 0; i < VM_LARGE_MAX; i++){
+        if(vm_large[i].size != 0 && vm_large[i].pid == pcb->pid){
+            vm_large[i].size = 0;
+        }
+    }
+    for(i = 0; i < TLB_WIRED_MAX; i++){
+        if(tlb_wired[i].used && tlb_wired[i].pid == pcb->pid){
+            tlb_wired_release(i);
+        }
     }
-    else{
-        bzero((uint32_t *)pa_2_va(page_map[free_index].paddr), PAGE_SIZE);
 
-        if(page_table_base_ptr == 0){
-            page_map[free_index].avail = 0;
-            page_map[free_index].pinned = pinned;
-            page_map[free_index].R = 1;
-            page_map[free_index].pid = PID;
+    tlb_flush_asid(pcb->asid);
+}
+
+/*
+ * give dst a copy-on-write view of src's user pages: both sides map the same 
+ * frames without PTE_D, and the first store from either copies the frame. 
+ * pages of src that are out in swap are read into private frames for dst.
+ * returns -1 if dst ran out of frames or page tables.
+ */
+int vm_share_cow(pcb_t *dst, pcb_t *src)
+{
+    uint32_t *dir = (uint32_t *)src->page_table_base_addr;
+    uint32_t *table, *pte, vaddr;
+    int i, j, index;
+
+    if(vma_copy(dst, src) < 0){
+        return -1;
+    }
+    if(dir == NULL){
+        return 0;
+    }
+    for(i = 0; i < PGDIR_ENTRIES_NUM; i++){
+        table = (uint32_t *)dir[i];
+        if(table == NULL){
+            continue;
         }
-        else{
-            // page_map[free_index].vaddr = current_running->user_context.cp0_badvaddr;
-            page_map[free_index].vaddr = get_cp0_badvaddr();
-            page_map[free_index].VPN = ((get_cp0_badvaddr() & 0xfffff000) >> 12);
-            page_map[free_index].pid = current_running->pid;
-            page_map[free_index].avail = 0;
-            page_map[free_index].pinned = pinned;
-            page_map[free_index].R = 1;
+        for(j = 0; j < PGTABLE_ENTRIES_NUM; j++){
+            if(table[j] == 0){
+                continue;
+            }
+            vaddr = (i << PGDIR_SHIFT) | (j << 12);
+            if((pte = pte_lookup(dst, vaddr, TRUE)) == NULL){
+                return -1;
+            }
+            if(table[j] & PTE_SWAPPED){
+                //the swap unit stays src's, dst's copy has to be written out on its own
+                if((index = page_alloc(vaddr, 0)) < 0){
+                    return -1;
+                }
+                sdread((unsigned char *)page_frame_vaddr(index), swap_unit_offset(table[j] & ~PTE_SWAPPED), PAGE_SIZE);
+                page_map[index].pid   = dst->pid;
+                page_map[index].dirty = 1;
+                page_map[index].R     = 0;
+                *pte = (page_map[index].PFN << 6) | PTE_C;
+                continue;
+            }
+            index = pte_frame_index(table[j]);
+            //large regions and wired pairs are mapped writable behind the clock's back, they are not inherited
+            if(index != zero_page_index && page_map[index].pinned){
+                continue;
+            }
+            if(index != zero_page_index){
+                table[j] &= ~PTE_D;
+                page_map[index].share++;
+            }
+            *pte = table[j];
         }
+    }
+    //src's cached entries may still carry D
+    tlb_flush_asid(src->asid);
+    return 0;
+}
 
-        if(free_page_frame_num > 0){
-            free_page_frame_num--;
+/* npages free frames in a row, starting on a multiple of npages; -1 if there is no such run */
+static int frame_alloc_contig(int npages)
+{
+    int i, j;
+
+    for(i = 0; i + npages <= FRAME_PAGES; i += npages){
+        for(j = i; j < i + npages && page_map[j].avail == 1; j++){
+            ;
         }
+        if(j == i + npages){
+            return i;
+        }
+    }
+    return -1;
+}
 
-        return free_index;
+/* undo the part of a large region that is already mapped */
+static void vm_unmap_large(pcb_t *pcb, uint32_t vaddr, uint32_t size)
+{
+    uint32_t *pte;
+    uint32_t va;
+    int index;
+
+    for(va = vaddr; va < vaddr + size; va += PAGE_SIZE){
+        pte = pte_lookup(pcb, va, FALSE);
+        if(pte == NULL || *pte == 0){
+            continue;
+        }
+        index = pte_frame_index(*pte);
+        page_map[index].avail  = 1;
+        page_map[index].pinned = 0;
+        page_map[index].share  = 0;
+        page_map[index].pid    = 0;
+        free_page_frame_num++;
+        *pte = 0;
     }
 }
 
-static void set_up_page_table()
+/* fill [vaddr, vaddr + size) with page_size runs of contiguous frames, nothing stays mapped on failure */
+static int vm_map_large_chunks(pcb_t *pcb, uint32_t vaddr, uint32_t size, uint32_t page_size)
 {
-    //page map index for a page table  
-    bool_t pinned = TRUE;
-    int i = 0;
-    while(i < PAGE_TABLE_PAGES){
-        page_alloc(pinned,0,0);
-        i++;
+    uint32_t va, chunk;
+    uint32_t *pte;
+    int first, index;
+
+    for(chunk = vaddr; chunk < vaddr + size; chunk += page_size){
+        first = frame_alloc_contig(page_size / PAGE_SIZE);
+        if(first < 0){
+            vm_unmap_large(pcb, vaddr, chunk - vaddr);
+            return -1;
+        }
+        for(index = first, va = chunk; va < chunk + page_size; index++, va += PAGE_SIZE){
+            if((pte = pte_lookup(pcb, va, TRUE)) == NULL){
+                vm_unmap_large(pcb, vaddr, va - vaddr);
+                return -1;
+            }
+            bzero((uint32_t *)page_frame_vaddr(index), PAGE_SIZE);
+            page_map[index].vaddr      = va;
+            page_map[index].VPN        = va >> 12;
+            page_map[index].pid        = pcb->pid;
+            page_map[index].avail      = 0;
+            page_map[index].pinned     = 1;
+            page_map[index].dirty      = 1;
+            page_map[index].R          = 1;
+            page_map[index].share      = 1;
+            page_map[index].swap_index = -1;
+            free_page_frame_num--;
+            *pte = (page_map[index].PFN << 6) | PTE_C | PTE_D;
+        }
+    }
+    return 0;
+}
+
+/*
+ * back [vaddr, vaddr + size) of pcb with pinned, physically contiguous frames 
+ * so that each even/odd pair of large pages fits in one TLB entry. the page 
+ * size is the biggest of 16MB/1MB/64KB that vaddr and size are aligned to 
+ * twice over and that the frame area can hold (it is 8MB, so 16MB pages are 
+ * never used on this board); when the frames for it are not there, the next 
+ * smaller size is tried. the PTEs are filled in (without PTE_V, so the refill 
+ * vector leaves them to handle_tlb) to keep exit and the table walkers working.
+ * returns the page size used, or -1.
+ */
+int vm_map_large(pcb_t *pcb, uint32_t vaddr, uint32_t size)
+{
+    uint32_t page_size = 0, va;
+    uint32_t *pte;
+    int i, slot = -1;
+
+    if(size == 0 || vaddr >= VM_SIZE || size > VM_SIZE - vaddr){
+        return -1;
+    }
+    for(i = 0; i < VM_LARGE_MAX; i++){
+        if(vm_large[i].size == 0){
+            slot = i;
+            break;
+        }
+    }
+    if(slot < 0){
+        return -1;
     }
+    for(va = vaddr; va < vaddr + size; va += PAGE_SIZE){
+        pte = pte_lookup(pcb, va, FALSE);
+        if(pte != NULL && *pte != 0){
+            return -1;
+        }
+    }
+
+    for(i = 0; i < sizeof(large_page_size) / sizeof(large_page_size[0]); i++){
+        if(large_page_size[i] > FRAME_SIZE || ((vaddr | size) & (2 * large_page_size[i] - 1)) != 0){
+            continue;
+        }
+        if(vm_map_large_chunks(pcb, vaddr, size, large_page_size[i]) == 0){
+            page_size = large_page_size[i];
+            break;
+        }
+    }
+    if(page_size == 0){
+        return -1;
+    }
+
+    vm_large[slot].pid       = pcb->pid;
+    vm_large[slot].vaddr     = vaddr;
+    vm_large[slot].size      = size;
+    vm_large[slot].page_size = page_size;
+    return page_size;
 }
 
+
 /*
 //TASK 1 initialization
 void fill_page_table()
@@ -346,7 +892,6 @@ static void fill_tlb()
     uint32_t cp0_entrylo0;
     uint32_t cp0_entrylo1;
     uint32_t cp0_index;
-    uint32_t *page_table = (uint32_t *)page_table_base_ptr;
     uint32_t VPN2;
     uint32_t PFN0;
     uint32_t PFN1;
@@ -359,7 +904,8 @@ static void fill_tlb()
         // VPN2 = ((2 * i * PAGE_SIZE) & 0xffffe000) >> 13;
         // BUG!!!
         // VPN2 = (((2 * i * PAGE_SIZE) & 0xffffe000) >> 13);
-        VPN2 = 0xffff7;
+        //a distinct kseg0 VPN2 per entry: never matched, and no duplicate entries
+        VPN2 = ((0x80000000 >> 13) + i);
         cp0_entryhi = (VPN2 << 13);
         cp0_pagemask = 0;
         PFN0 = 0;
@@ -385,13 +931,38 @@ static void fill_tlb()
 
         asm volatile("tlbwi");
     }
-    
+    set_cp0_wired(0);
 }
 
 //for debug
+/* snapshot the hardware TLB into tlb_table, EntryHi (our ASID) is kept */
+static void tlb_read_all()
+{
+    uint32_t cp0_status = get_cp0_status();
+    uint32_t entryhi = get_cp0_entryhi();
+    int i;
+
+    set_cp0_status(cp0_status & 0xfffffffe);
+    for(i = 0; i < TLB_ENTRIES_NUM; i++){
+        set_cp0_index(i);
+        asm volatile("tlbr");
+        tlb_table[i].index = i;
+        tlb_table[i].VPN2  = get_cp0_entryhi() >> 13;
+        tlb_table[i].pid   = get_cp0_entryhi() & ASID_MASK;
+        tlb_table[i].PFN0  = get_cp0_entrylo0() >> 6;
+        tlb_table[i].PFN1  = get_cp0_entrylo1() >> 6;
+        tlb_table[i].empty = ((get_cp0_entrylo0() | get_cp0_entrylo1()) & PTE_V) == 0;
+    }
+    //tlbr loads PageMask too, and the refill vector writes with whatever is left there
+    set_cp0_pagemask(0);
+    set_cp0_entryhi(entryhi);
+    set_cp0_status(cp0_status);
+}
+
 void read_tlb_1()
 {
     int i = 0;
+    tlb_read_all();
     sys_move_cursor(1, 14);
     printf("Em \t Id \t V2 \t P0 \t P1");
     // for(; i < TLB_ENTRIES_NUM; i++){
@@ -424,10 +995,13 @@ void read_page_map()
 }
 */
 
-void init_memory()
+//init page frames, shared by the kernel heap and the page fault path
+void init_page_map()
 {
-    //init page frames 
     int i;
+    if(page_map_ready){
+        return;
+    }
     for(i = 0; i < FRAME_PAGES; i++){
         page_map[i].paddr      = page_frame_paddr(i);
         page_map[i].vaddr      = 0;        
@@ -436,36 +1010,79 @@ void init_memory()
         page_map[i].pid        = 0;
         page_map[i].index      = i;
         page_map[i].avail      = 1;
-        page_map[i].dirty      = 1;
+        page_map[i].dirty      = 0;
         page_map[i].pinned     = 0;
         page_map[i].swaped     = 0;
         page_map[i].swap_index = -1;
+        page_map[i].share      = 0;
         page_map[i].R          = 0;
     }
 
-    for(; i < PAGEABLE_PAGES; i++){
-        page_map[i].paddr      = 0;
-        page_map[i].vaddr      = 0;        
-        page_map[i].VPN        = 0;
-        page_map[i].PFN        = 0;
-        page_map[i].pid        = 0;
-        page_map[i].index      = i;
-        page_map[i].avail      = 1;
-        page_map[i].dirty      = 1;
-        page_map[i].pinned     = 0;
-        page_map[i].swaped     = 1;
-        page_map[i].swap_index = i - FRAME_PAGES;
-        page_map[i].R          = 0;
+    bzero(swap_bitmap, sizeof(swap_bitmap));
+    swap_page_alloc_ptr = 0;
+    free_page_frame_num = FRAME_PAGES;
+    page_map_ready = TRUE;
+}
+
+uint32_t page_free_frames()
+{
+    return free_page_frame_num;
+}
+
+/* 
+ * take npages contiguous free frames for the kernel, searched from the top 
+ * so the page fault path (which walks up from page_alloc_ptr) rarely meets them.
+ * the frames are pinned and never picked by the clock. returns 0 if no room.
+ */
+uint32_t kpage_alloc(int npages)
+{
+    int i, j, run = 0;
+
+    if(npages <= 0 || npages > free_page_frame_num){
+        return 0;
+    }
+    for(i = FRAME_PAGES - 1; i >= 0; i--){
+        run = (page_map[i].avail == 1) ? run + 1 : 0;
+        if(run == npages){
+            for(j = i; j < i + npages; j++){
+                page_map[j].avail  = 0;
+                page_map[j].pinned = 1;
+                page_map[j].R      = 1;
+                page_map[j].pid    = 0;
+                page_map[j].vaddr  = page_frame_vaddr(j);
+            }
+            free_page_frame_num -= npages;
+            return page_frame_vaddr(i);
+        }
+    }
+    return 0;
+}
+
+void kpage_free(uint32_t vaddr, int npages)
+{
+    int i = (vaddr - PAGE_FRAME_START) / PAGE_SIZE;
+    int end = i + npages;
+
+    for(; i < end; i++){
+        page_map[i].avail  = 1;
+        page_map[i].pinned = 0;
+        page_map[i].R      = 0;
+        page_map[i].vaddr  = 0;
     }
-    //arrange n pinned page frame for global page table
-    set_up_page_table();
-    page_table_base_ptr = PAGE_FRAME_START;
+    free_page_frame_num += npages;
+}
 
-    // bzero((uint32_t *)(PAGE_FRAME_START + PAGE_TABLE_SIZE), VM_SIZE);
+void init_memory()
+{
+    init_page_map();
 
+    swap_buffer = (uint8_t *)kmalloc(SWAP_BATCH * PAGE_SIZE);
+    zero_page_index = (kpage_alloc(1) - PAGE_FRAME_START) / PAGE_SIZE;
+    bzero((uint8_t *)page_frame_vaddr(zero_page_index), PAGE_SIZE);
+    do_semaphore_init(&sem_swap, 0);
+    swapd_wakeup_pending = FALSE;
 
-    //TASK 1
-    // fill_page_table();
+    //page tables are per process, allocated on the first fault
 
     fill_tlb();
 
@@ -491,308 +1108,357 @@ void print()
 	printk("init_exception");
 }
 
-static bool_t check_tlb_wrong_access()
+/* 
+ * refresh the TLB copy of the pair around vaddr in address space asid after 
+ * its PTEs changed; nothing to do if the pair is not cached
+ */
+static void tlb_sync_pair(uint32_t vaddr, uint32_t asid, uint32_t *pte)
 {
-    uint32_t VPN2 = ((get_cp0_entryhi() & 0xffffe000) >> 13);
+    uint32_t *pair = (uint32_t *)((uint32_t)pte & ~0x7);
+    uint32_t cp0_status = get_cp0_status();
+    uint32_t entryhi = get_cp0_entryhi();
 
-    int i = 0;
-    while(i < TLB_ENTRIES_NUM){
-        if(tlb_table[i].VPN2 == VPN2 && tlb_table[i].pid != current_running->pid){
-            wrong_pid = tlb_table[i].pid;
-            return 1;
-        }
-        i++;
+    set_cp0_status(cp0_status & 0xfffffffe);
+    set_cp0_entryhi((vaddr & 0xffffe000) | asid);
+    asm volatile("tlbp");
+    if((get_cp0_index() & 0x80000000) == 0){
+        set_cp0_entrylo0(pair[0]);
+        set_cp0_entrylo1(pair[1]);
+        set_cp0_pagemask(0);
+        asm volatile("tlbwi");
     }
-    return 0;
+    set_cp0_entryhi(entryhi);
+    set_cp0_status(cp0_status);
 }
 
-static uint32_t get_tlb_invalid_index()
+/*
+ * write one entry that maps a pair of large pages at base. every small entry 
+ * of this ASID that overlaps it (refilled while the big one was out of the 
+ * TLB) is parked on its own kseg0 VPN2 first, two matching entries would 
+ * be a machine check. PageMask goes back to 0 for the refill vector.
+ */
+static void tlb_write_large(uint32_t base, uint32_t page_size, uint32_t entrylo0, uint32_t entrylo1)
 {
-    uint32_t VPN2 = ((get_cp0_entryhi() & 0xffffe000) >> 13);
-
-    int i = 0;
-    while(i < TLB_ENTRIES_NUM){
-        if(tlb_table[i].VPN2 == VPN2 && tlb_table[i].pid == current_running->pid){
-            return i;
+    uint32_t asid = current_running->asid;
+    uint32_t va, index;
+
+    for(va = base; va < base + 2 * page_size; va += 2 * PAGE_SIZE){
+        set_cp0_entryhi(va | asid);
+        asm volatile("tlbp");
+        index = get_cp0_index();
+        if((index & 0x80000000) == 0){
+            set_cp0_entryhi(0x80000000 | (index << 13));
+            set_cp0_entrylo0(0);
+            set_cp0_entrylo1(0);
+            set_cp0_pagemask(0);
+            asm volatile("tlbwi");
         }
-        i++;
     }
+
+    set_cp0_entryhi(base | asid);
+    set_cp0_entrylo0(entrylo0);
+    set_cp0_entrylo1(entrylo1);
+    set_cp0_pagemask(((page_size >> 12) - 1) << 13);
+    asm volatile("tlbwr");
+    set_cp0_pagemask(0);
+    tlb_large_count++;
 }
 
-void handle_tlb_exception_helper()
+/* a fault inside one of current_running's large regions, 0 if badvaddr is not in one */
+static int vm_large_fault(uint32_t badvaddr)
 {
+    uint32_t base, page_size;
+    uint32_t *pte0, *pte1;
+    int i;
 
-    vt100_move_cursor(1, 47);
-    printk("DEBUG >> ");
-    printk("%d %d", ((uint32_t *)page_table_base_ptr)[0], ((uint32_t *)page_table_base_ptr)[1]);
-
-	vt100_move_cursor(1, 48);
-    printk("%d %d %d", page_alloc_ptr, page_map[page_alloc_ptr].paddr, page_map[page_alloc_ptr].PFN);
-    vt100_move_cursor(1, 49);
-    printk("%d %d %d", 0, page_map[0].paddr, page_map[0].PFN);
-
-    uint32_t cp0_pagemask = 0;
-    uint32_t EntryHi = get_cp0_entryhi();
-    uint32_t badvpn2 = ((EntryHi & 0xffffe000) >> 13);
-    uint32_t badvaddr = get_cp0_badvaddr();
-    uint32_t EntryLo_is_odd = ((badvaddr & 0x1000) >> 12);
-    uint32_t badvpn = ((badvaddr & 0xfffff000) >> 12);
-    uint32_t *page_table = (uint32_t *)page_table_base_ptr;
-    // uint32_t *badpte_ptr = &(page_table[badvpn]);
-
-	// vt100_move_cursor(1, 1);
-    // printk("%d ", EntryHi);
-
-    uint32_t pid = current_running->pid;
-
-    asm volatile("tlbp");
-    uint32_t index = get_cp0_index();
-    //TLB refill handler
-    if(((index & 0x80000000) >> 31) == 1){
-
-        vt100_move_cursor(1, 46);
-        printk("DEBUG >> ");
-        printk("%d", 111);
-
-        tlb_refill_count++;
-        
-        //check whether have the right to have access to the virtual address
-        if(check_tlb_wrong_access() == 1){
-            vt100_move_cursor(1, 45);
-            printk("ERROR! Current running pid is %d, but virtual address is in pid %d address space", pid, wrong_pid);
-            return;
+    for(i = 0; i < VM_LARGE_MAX; i++){
+        if(vm_large[i].size != 0 && vm_large[i].pid == current_running->pid
+           && badvaddr >= vm_large[i].vaddr && badvaddr - vm_large[i].vaddr < vm_large[i].size){
+            break;
         }
-        
-        //PTE is not empty and PFN is in memory
-        if(page_table[badvpn] != 0 && ((page_table[badvpn] & PTE_V) == PTE_V)){
-
-            vt100_move_cursor(1, 46);
-            printk("DEBUG >> ");
-            printk("%d", 222);
-
-            tlb_entry_index_ptr = (tlb_entry_index_ptr + 1) % TLB_ENTRIES_NUM;
-            set_cp0_index(tlb_entry_index_ptr);  
-
-            tlb_flush_no_check();
+    }
+    if(i == VM_LARGE_MAX){
+        return 0;
+    }
 
-            uint32_t PFN = ((page_table[badvpn] & 0xfffff000) >> 12);
+    page_size = vm_large[i].page_size;
+    base = badvaddr & ~(2 * page_size - 1);
+    pte0 = pte_lookup(current_running, base, FALSE);
+    pte1 = pte_lookup(current_running, base + page_size, FALSE);
+    tlb_write_large(base, page_size, *pte0 | PTE_V, *pte1 | PTE_V);
+    return 1;
+}
 
-            if(EntryLo_is_odd == 1){
-                uint32_t EntryLo1 = (PFN << 6) | PTE_C | PTE_D | PTE_V;
-                set_cp0_entrylo1(EntryLo1);
-            }
-            else{
-                uint32_t EntryLo0 = (PFN << 6) | PTE_C | PTE_D | PTE_V;
-                set_cp0_entrylo0(EntryLo0);                
-            }
-            set_cp0_pagemask(cp0_pagemask);
+/* write the even/odd PTE pair around vaddr into the TLB, over a stale entry if there is one */
+static void tlb_write_pair(uint32_t vaddr, uint32_t *pte)
+{
+    uint32_t *pair = (uint32_t *)((uint32_t)pte & ~0x7);
 
-            // tlb_entry_index_ptr = (tlb_entry_index_ptr + 1) % TLB_ENTRIES_NUM;
-            // set_cp0_index(tlb_entry_index_ptr);      
+    set_cp0_entryhi((vaddr & 0xffffe000) | current_running->asid);
+    asm volatile("tlbp");
 
-            EntryHi = ((EntryHi & 0xffffe000) | pid);
-            set_cp0_entryhi(EntryHi);
+    set_cp0_entrylo0(pair[0]);
+    set_cp0_entrylo1(pair[1]);
+    set_cp0_pagemask(0);
 
-            asm volatile("tlbwi");
+    if(get_cp0_index() & 0x80000000){
+        //came through the refill vector, already counted there
+        asm volatile("tlbwr");
+    }
+    else{
+        tlb_invalid_count++;
+        asm volatile("tlbwi");
+    }
+}
 
-            tlb_table[tlb_entry_index_ptr].pid = current_running->pid;
-            tlb_table[tlb_entry_index_ptr].empty = 0;
-            tlb_table[tlb_entry_index_ptr].index = tlb_entry_index_ptr;
-            if(EntryLo_is_odd == 1){
-                tlb_table[tlb_entry_index_ptr].PFN1 = ((get_cp0_entrylo1() & 0xffffffc0) >> 6);
-            }
-            else{
-                tlb_table[tlb_entry_index_ptr].PFN0 = ((get_cp0_entrylo0() & 0xffffffc0) >> 6);
-            }
-            tlb_table[tlb_entry_index_ptr].VPN2 = ((get_cp0_entryhi() & 0xffffe000) >> 13);
+/* 
+ * bring the page behind pte (current_running's, at vaddr) into the state an 
+ * access needs: map, swap in, copy on write, or just note the reference and, 
+ * for a store, the dirty bit. returns the frame, -1 if none could be had.
+ */
+static int page_fault_resolve(uint32_t *pte, uint32_t vaddr, bool_t store)
+{
+    int index, shared;
 
-            return;
+    //PTE is empty and this is a load: map the zero page, a frame is only spent on the first store
+    if(*pte == 0 && !store){
+        *pte = (page_map[zero_page_index].PFN << 6) | PTE_C | PTE_V;
+        page_zero_map_count++;
+        return zero_page_index;
+    }
+    //PTE is empty: first touch is a store, give it a zeroed frame
+    if(*pte == 0 || (*pte & PTE_SWAPPED)){
+        index = page_alloc(vaddr, 0);
+        if(index < 0){
+            return -1;
         }
-        //PTE is not empty but PFN is in swap
-        else if(page_table[badvpn] != 0 && ((page_table[badvpn] & PTE_V) == 0)){
-            vt100_move_cursor(1, 46);
-            printk("DEBUG >> ");
-            printk("%d", 333);
-            
-
+        //PTE is not empty but the page is in swap: read it back, the swap copy stays valid until a store
+        if(*pte & PTE_SWAPPED){
+            swap_in(index, vaddr & 0xfffff000, *pte & ~PTE_SWAPPED);
         }
-        //PTE is empty 
-        else if(page_table[badvpn] == 0){
-    
-            vt100_move_cursor(1, 46);
-            printk("DEBUG >> ");
-            printk("%d", 444);
-
-            if(free_page_frame_num != 0){
-                bool_t pinned = 0;
-                int index = page_alloc(pinned,0,0);
-                uint32_t PFN = ((page_map[index].paddr & 0xfffff000) >> 12);
-                page_table[badvpn] = (PFN << 12) | PTE_C | PTE_D | PTE_V;
-
-                vt100_move_cursor(1, 50);
-                printk("%d %d %d %d %d", page_alloc_ptr, page_map[page_alloc_ptr].paddr, page_map[page_alloc_ptr].PFN, index, PFN);
-
-                tlb_entry_index_ptr = (tlb_entry_index_ptr + 1) % TLB_ENTRIES_NUM;
-                set_cp0_index(tlb_entry_index_ptr);  
-
-                tlb_flush_no_check();
-
-                if(EntryLo_is_odd == 1){
-                    uint32_t EntryLo1 = (PFN << 6) | PTE_C | PTE_D | PTE_V;
-                    set_cp0_entrylo1(EntryLo1);
-                }
-                else{
-                    uint32_t EntryLo0 = (PFN << 6) | PTE_C | PTE_D | PTE_V;
-                    set_cp0_entrylo0(EntryLo0);                
-                }
-                set_cp0_pagemask(cp0_pagemask);
-
-                // tlb_entry_index_ptr = (tlb_entry_index_ptr + 1) % TLB_ENTRIES_NUM;
-                // set_cp0_index(tlb_entry_index_ptr);      
-
-                EntryHi = ((EntryHi & 0xffffe000) | pid);
-                set_cp0_entryhi(EntryHi);
-
-                asm volatile("tlbwi");
-
-                tlb_table[tlb_entry_index_ptr].pid = current_running->pid;
-                tlb_table[tlb_entry_index_ptr].empty = 0;
-                tlb_table[tlb_entry_index_ptr].index = tlb_entry_index_ptr;
-                if(EntryLo_is_odd == 1){
-                    tlb_table[tlb_entry_index_ptr].PFN1 = ((get_cp0_entrylo1() & 0xffffffc0) >> 6);
-                }
-                else{
-                    tlb_table[tlb_entry_index_ptr].PFN0 = ((get_cp0_entrylo0() & 0xffffffc0) >> 6);
-                }
-                tlb_table[tlb_entry_index_ptr].VPN2 = ((get_cp0_entryhi() & 0xffffe000) >> 13);
-                
-                return;
-            }
-            else{
-  
-            }
+        else{
+            bzero((uint32_t *)page_frame_vaddr(index), PAGE_SIZE);
+        }
+        *pte = (page_map[index].PFN << 6) | PTE_C | PTE_V;
+    }
+    //store to the zero page or a frame shared by a COW spawn: take a private copy
+    else if(store && (pte_frame_index(*pte) == zero_page_index || page_map[pte_frame_index(*pte)].share > 1)){
+        shared = pte_frame_index(*pte);
+        index = page_alloc(vaddr, 0);
+        if(index < 0){
+            return -1;
+        }
+        if(shared == zero_page_index){
+            bzero((uint32_t *)page_frame_vaddr(index), PAGE_SIZE);
         }
         else{
-
+            memcpy((uint8_t *)page_frame_vaddr(index), (uint8_t *)page_frame_vaddr(shared), PAGE_SIZE);
+            page_map[shared].share--;
         }
+        *pte = (page_map[index].PFN << 6) | PTE_C | PTE_V;
+        page_cow_count++;
     }
-    //TLB invalid handler
+    //PTE is present but invalid, or a store to a clean page: first touch since the clock hand went by
     else{
-        vt100_move_cursor(1, 46);
-        printk("DEBUG >> ");
-        printk("%d", 555);
+        index = pte_frame_index(*pte);
+        *pte |= PTE_V;
+        page_map[index].R = 1;
+        //the last sharer left takes over a frame whose recorded owner went away
+        if(index != zero_page_index && page_map[index].share == 1){
+            page_map[index].pid   = current_running->pid;
+            page_map[index].vaddr = vaddr & 0xfffff000;
+        }
+    }
 
-        tlb_invalid_count++;
-        
-        //PTE is empty
-        if(page_table[badvpn] == 0){
-            vt100_move_cursor(1, 46);
-            printk("DEBUG >> ");
-            printk("%d", 666);
-
-            if(free_page_frame_num != 0){
-                bool_t pinned = 0;
-                int index = page_alloc(pinned,0,1);
-                uint32_t PFN = ((page_map[index].paddr & 0xfffff000) >> 12);
-                page_table[badvpn] = (PFN << 12) | PTE_C | PTE_D | PTE_V;
-
-                vt100_move_cursor(1, 50);
-                printk("%d %d %d %d %d", page_alloc_ptr, page_map[page_alloc_ptr].paddr, page_map[page_alloc_ptr].PFN, index, PFN);
-
-                uint32_t tlb_invalid_index = get_tlb_invalid_index();
-                set_cp0_index(tlb_invalid_index); 
-
-                uint32_t EntryLo1, EntryLo0;
-                if(EntryLo_is_odd == 1){
-                    EntryLo1 = (PFN << 6) | PTE_C | PTE_D | PTE_V;
-                    EntryLo0 = (tlb_table[tlb_invalid_index].PFN0 << 6) | PTE_C | PTE_D | PTE_V;
-                }
-                else{
-                    EntryLo0 = (PFN << 6) | PTE_C | PTE_D | PTE_V;
-                    EntryLo1 = (tlb_table[tlb_invalid_index].PFN1 << 6) | PTE_C | PTE_D | PTE_V;
-                }
-                set_cp0_entrylo0(EntryLo0); 
-                set_cp0_entrylo1(EntryLo1);
+    //D is only granted on a store (TLB modified, or a store that missed)
+    if(store){
+        *pte |= PTE_D;
+        page_map[index].dirty = 1;
+    }
+    return index;
+}
 
-                set_cp0_pagemask(cp0_pagemask);     
+/* park wired slot index on its own kseg0 VPN2 and shrink CP0_Wired to the slots still in use */
+static void tlb_wired_release(int slot)
+{
+    uint32_t entryhi = get_cp0_entryhi();
+    int wired = 0, i;
+
+    tlb_wired[slot].used = FALSE;
+    set_cp0_index(slot);
+    set_cp0_entryhi(0x80000000 | (slot << 13));
+    set_cp0_entrylo0(0);
+    set_cp0_entrylo1(0);
+    set_cp0_pagemask(0);
+    asm volatile("tlbwi");
+    set_cp0_entryhi(entryhi);
+
+    for(i = 0; i < TLB_WIRED_MAX; i++){
+        if(tlb_wired[i].used){
+            wired = i + 1;
+        }
+    }
+    set_cp0_wired(wired);
+}
+
+static int tlb_wired_find(uint32_t vaddr)
+{
+    int i;
+    for(i = 0; i < TLB_WIRED_MAX; i++){
+        if(tlb_wired[i].used && tlb_wired[i].pid == current_running->pid
+           && tlb_wired[i].vaddr == (vaddr & 0xffffe000)){
+            return i;
+        }
+    }
+    return -1;
+}
 
-                EntryHi = ((EntryHi & 0xffffe000) | pid);
-                set_cp0_entryhi(EntryHi);
+/*
+ * make the page pair around vaddr resident, private and dirty for current_running,
+ * pin both frames and write the pair into a wired TLB slot, so neither the
+ * clock nor tlbwr ever takes it away. returns the slot, -1 if none is left or
+ * the pages cannot be had.
+ */
+int vm_wire(uint32_t vaddr)
+{
+    uint32_t base = vaddr & 0xffffe000;
+    uint32_t cp0_status, entryhi;
+    uint32_t *pte[2];
+    int index[2], slot = -1, i, hit;
 
-                asm volatile("tlbwi");
+    if(vaddr >= VM_SIZE || !vma_allows(current_running, base) || !vma_allows(current_running, base + PAGE_SIZE)){
+        return -1;
+    }
+    for(i = 0; i < VM_LARGE_MAX; i++){
+        if(vm_large[i].size != 0 && vm_large[i].pid == current_running->pid
+           && base >= vm_large[i].vaddr && base - vm_large[i].vaddr < vm_large[i].size){
+            return -1;
+        }
+    }
+    if((slot = tlb_wired_find(base)) >= 0){
+        return slot;
+    }
+    for(i = 0; i < TLB_WIRED_MAX; i++){
+        if(!tlb_wired[i].used){
+            slot = i;
+            break;
+        }
+    }
+    if(slot < 0){
+        return -1;
+    }
 
-                tlb_table[tlb_invalid_index].pid = current_running->pid;
-                tlb_table[tlb_invalid_index].empty = 0;
-                tlb_table[tlb_invalid_index].index = tlb_invalid_index;
-                if(EntryLo_is_odd == 1){
-                    tlb_table[tlb_invalid_index].PFN1 = ((get_cp0_entrylo1() & 0xffffffc0) >> 6);
-                }
-                else{
-                    tlb_table[tlb_invalid_index].PFN0 = ((get_cp0_entrylo0() & 0xffffffc0) >> 6);
-                }
-                tlb_table[tlb_invalid_index].VPN2 = ((get_cp0_entryhi() & 0xffffe000) >> 13);
-                
-                return;
+    for(i = 0; i < 2; i++){
+        pte[i] = pte_lookup(current_running, base + i * PAGE_SIZE, TRUE);
+        index[i] = (pte[i] == NULL) ? -1 : page_fault_resolve(pte[i], base + i * PAGE_SIZE, TRUE);
+        if(index[i] < 0){
+            if(i == 1){
+                page_map[index[0]].pinned = 0;
             }
-            //condition 1: invalid TLB, PTE empty, no free PFN
-            else{
-                bool_t pinned = 0;
-                int index = page_alloc(pinned,0,1);
-                uint32_t PFN = ((page_map[index].paddr & 0xfffff000) >> 12);
-                page_table[badvpn] = (PFN << 12) | PTE_C | PTE_D | PTE_V;
-
-                vt100_move_cursor(1, 50);
-                printk("%d %d %d %d %d", page_alloc_ptr, page_map[page_alloc_ptr].paddr, page_map[page_alloc_ptr].PFN, index, PFN);
-
-                uint32_t tlb_invalid_index = get_tlb_invalid_index();
-                set_cp0_index(tlb_invalid_index); 
-
-                uint32_t EntryLo1, EntryLo0;
-                if(EntryLo_is_odd == 1){
-                    EntryLo1 = (PFN << 6) | PTE_C | PTE_D | PTE_V;
-                    EntryLo0 = (tlb_table[tlb_invalid_index].PFN0 << 6) | PTE_C | PTE_D | PTE_V;
-                }
-                else{
-                    EntryLo0 = (PFN << 6) | PTE_C | PTE_D | PTE_V;
-                    EntryLo1 = (tlb_table[tlb_invalid_index].PFN1 << 6) | PTE_C | PTE_D | PTE_V;
-                }
-                set_cp0_entrylo0(EntryLo0); 
-                set_cp0_entrylo1(EntryLo1);
+            return -1;
+        }
+        //pinned right away, or the second page_alloc could take the first one back
+        page_map[index[i]].pinned = 1;
+    }
 
-                set_cp0_pagemask(cp0_pagemask);     
+    cp0_status = get_cp0_status();
+    set_cp0_status(cp0_status & 0xfffffffe);
+    entryhi = get_cp0_entryhi();
 
-                EntryHi = ((EntryHi & 0xffffe000) | pid);
-                set_cp0_entryhi(EntryHi);
+    //a random-replaced copy of the pair must not stay next to the wired one
+    set_cp0_entryhi(base | current_running->asid);
+    asm volatile("tlbp");
+    hit = get_cp0_index();
+    if((hit & 0x80000000) == 0 && hit != slot){
+        set_cp0_entryhi(0x80000000 | (hit << 13));
+        set_cp0_entrylo0(0);
+        set_cp0_entrylo1(0);
+        set_cp0_pagemask(0);
+        asm volatile("tlbwi");
+    }
 
-                asm volatile("tlbwi");
+    if(get_cp0_wired() < slot + 1){
+        set_cp0_wired(slot + 1);
+    }
+    set_cp0_index(slot);
+    set_cp0_entryhi(base | current_running->asid);
+    set_cp0_entrylo0(*pte[0]);
+    set_cp0_entrylo1(*pte[1]);
+    set_cp0_pagemask(0);
+    asm volatile("tlbwi");
+
+    set_cp0_entryhi(entryhi);
+    set_cp0_status(cp0_status);
+
+    tlb_wired[slot].used  = TRUE;
+    tlb_wired[slot].pid   = current_running->pid;
+    tlb_wired[slot].vaddr = base;
+    return slot;
+}
 
-                tlb_table[tlb_invalid_index].pid = current_running->pid;
-                tlb_table[tlb_invalid_index].empty = 0;
-                tlb_table[tlb_invalid_index].index = tlb_invalid_index;
-                if(EntryLo_is_odd == 1){
-                    tlb_table[tlb_invalid_index].PFN1 = ((get_cp0_entrylo1() & 0xffffffc0) >> 6);
-                }
-                else{
-                    tlb_table[tlb_invalid_index].PFN0 = ((get_cp0_entrylo0() & 0xffffffc0) >> 6);
-                }
-                tlb_table[tlb_invalid_index].VPN2 = ((get_cp0_entryhi() & 0xffffe000) >> 13);
-                
-                return;                
-            }            
+/* give back the wired slot of the pair around vaddr, its frames become pageable again */
+int vm_unwire(uint32_t vaddr)
+{
+    uint32_t *pte;
+    uint32_t cp0_status;
+    int slot = tlb_wired_find(vaddr), i;
+
+    if(slot < 0){
+        return -1;
+    }
+    for(i = 0; i < 2; i++){
+        pte = pte_lookup(current_running, tlb_wired[slot].vaddr + i * PAGE_SIZE, FALSE);
+        if(pte != NULL && *pte != 0 && !(*pte & PTE_SWAPPED)){
+            page_map[pte_frame_index(*pte)].pinned = 0;
         }
-        //PTE is not empty, but PFN is in swap
-        else if(page_table[badvpn] != 0 && ((page_table[badvpn] & PTE_V) == 0)){
-            vt100_move_cursor(1, 46);
-            printk("DEBUG >> ");
-            printk("%d", 777);
+    }
+    cp0_status = get_cp0_status();
+    set_cp0_status(cp0_status & 0xfffffffe);
+    tlb_wired_release(slot);
+    set_cp0_status(cp0_status);
+    return 0;
+}
+
+void handle_tlb_exception_helper()
+{
+    uint32_t badvaddr = get_cp0_badvaddr();
+    uint32_t exccode = (current_running->user_context.cp0_cause & CAUSE_EXCCODE) >> 2;
+    bool_t store = (exccode == MOD || exccode == TLBS);
+    uint32_t *pte;
+    int index;
+
+    if(badvaddr >= VM_SIZE){
+        printk("[TLB] pid %d: bad address %x\n", current_running->pid, badvaddr);
+        do_exit();
+        return;
+    }
+    if(!vma_allows(current_running, badvaddr)){
+        printk("[TLB] pid %d: %x is outside its memory areas\n", current_running->pid, badvaddr);
+        do_exit();
+        return;
+    }
 
+    if(vm_large_fault(badvaddr)){
+        return;
+    }
 
-        }
-        else{
+    pte = pte_lookup(current_running, badvaddr, TRUE);
+    if(pte == NULL){
+        printk("[TLB] pid %d: no frame left for a page table\n", current_running->pid);
+        do_exit();
+        return;
+    }
 
-        }
+    TRACE(TRACE_CLASS_FAULT, TRACE_PAGE_FAULT, badvaddr, *pte == 0);
 
+    index = page_fault_resolve(pte, badvaddr, store);
+    if(index < 0){
+        printk("[TLB] pid %d: out of memory at %x\n", current_running->pid, badvaddr);
+        do_exit();
+        return;
     }
+
+    tlb_write_pair(badvaddr, pte);
 }
 
 void print_sp_reg()
@@ -0,0 +1,251 @@
+#include "vma.h"
+#include "mm.h"
+#include "kmalloc.h"
+
+/*
+ * per-process memory areas behind mmap/munmap/brk. a task that never asked
+ * for memory keeps the old behaviour (any user address is demand paged, the
+ * project 4 tests type raw addresses in); the first mmap, brk or map_large
+ * switches it to checked mode, where a fault outside its areas kills it.
+ */
+
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+static vm_area_t *vma_find(pcb_t *pcb, uint32_t vaddr)
+{
+    vm_area_t *vma;
+    for(vma = pcb->vma_list; vma != NULL && vma->start <= vaddr; vma = vma->next){
+        if(vaddr < vma->end){
+            return vma;
+        }
+    }
+    return NULL;
+}
+
+/* 1 if [start, end) overlaps none of pcb's areas */
+static int vma_range_free(pcb_t *pcb, uint32_t start, uint32_t end)
+{
+    vm_area_t *vma;
+    for(vma = pcb->vma_list; vma != NULL && vma->start < end; vma = vma->next){
+        if(vma->end > start){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int vma_insert(pcb_t *pcb, uint32_t start, uint32_t end, uint32_t flags)
+{
+    vm_area_t **link = &pcb->vma_list;
+    vm_area_t *vma = (vm_area_t *)kmalloc(sizeof(vm_area_t));
+
+    if(vma == NULL){
+        return -1;
+    }
+    vma->start = start;
+    vma->end   = end;
+    vma->flags = flags;
+
+    while(*link != NULL && (*link)->start < start){
+        link = &((*link)->next);
+    }
+    vma->next = *link;
+    *link = vma;
+    return 0;
+}
+
+/* cut [start, end) out of the list, an area that straddles it is split in two */
+static int vma_remove(pcb_t *pcb, uint32_t start, uint32_t end)
+{
+    vm_area_t **link = &pcb->vma_list;
+    vm_area_t *vma, *spare = NULL;
+
+    //the only step that needs memory is done before anything changes
+    vma = vma_find(pcb, start);
+    if(vma != NULL && vma->start < start && vma->end > end){
+        if((spare = (vm_area_t *)kmalloc(sizeof(vm_area_t))) == NULL){
+            return -1;
+        }
+    }
+
+    while((vma = *link) != NULL && vma->start < end){
+        if(vma->end <= start){
+            link = &vma->next;
+        }
+        else if(vma->start < start && vma->end > end){
+            spare->start = end;
+            spare->end   = vma->end;
+            spare->flags = vma->flags;
+            spare->next  = vma->next;
+            vma->end  = start;
+            vma->next = spare;
+            break;
+        }
+        else if(vma->start < start){
+            vma->end = start;
+            link = &vma->next;
+        }
+        else if(vma->end > end){
+            vma->start = end;
+            break;
+        }
+        else{
+            *link = vma->next;
+            kfree(vma);
+        }
+    }
+    return 0;
+}
+
+/* first gap of length bytes in the mmap window, 0 if there is none */
+static uint32_t vma_find_gap(pcb_t *pcb, uint32_t length)
+{
+    uint32_t addr = USER_MMAP_BASE;
+    vm_area_t *vma;
+
+    for(vma = pcb->vma_list; vma != NULL; vma = vma->next){
+        if(vma->end <= addr){
+            continue;
+        }
+        if(vma->start >= addr + length){
+            break;
+        }
+        addr = vma->end;
+    }
+    return (addr + length <= USER_MMAP_END) ? addr : 0;
+}
+
+/* the stack window stays open either way */
+bool_t vma_allows(pcb_t *pcb, uint32_t vaddr)
+{
+    return !pcb->vma_enforced || vaddr >= USER_MMAP_END || vma_find(pcb, vaddr) != NULL;
+}
+
+/* dst gets a copy of src's areas (for a copy-on-write spawn) */
+int vma_copy(pcb_t *dst, pcb_t *src)
+{
+    vm_area_t *vma;
+
+    for(vma = src->vma_list; vma != NULL; vma = vma->next){
+        if(vma_insert(dst, vma->start, vma->end, vma->flags) < 0){
+            return -1;
+        }
+    }
+    dst->vma_enforced = src->vma_enforced;
+    dst->brk = src->brk;
+    return 0;
+}
+
+void vma_free_all(pcb_t *pcb)
+{
+    vm_area_t *vma;
+
+    while((vma = pcb->vma_list) != NULL){
+        pcb->vma_list = vma->next;
+        kfree(vma);
+    }
+    pcb->vma_enforced = FALSE;
+    pcb->brk = USER_HEAP_BASE;
+}
+
+/* anonymous, zero filled, demand paged; at addr if it is given, returns 0 on failure */
+uint32_t do_mmap(uint32_t addr, uint32_t length)
+{
+    pcb_t *pcb = current_running;
+
+    length = PAGE_ALIGN(length);
+    if(length == 0){
+        return 0;
+    }
+    if(addr != 0){
+        if((addr & (PAGE_SIZE - 1)) || addr >= VM_SIZE || length > VM_SIZE - addr
+           || !vma_range_free(pcb, addr, addr + length)){
+            return 0;
+        }
+    }
+    else if((addr = vma_find_gap(pcb, length)) == 0){
+        return 0;
+    }
+
+    if(vma_insert(pcb, addr, addr + length, VMA_MMAP) < 0){
+        return 0;
+    }
+    pcb->vma_enforced = TRUE;
+    return addr;
+}
+
+/* the range's frames and swap units go back to the pools right away */
+int do_munmap(uint32_t addr, uint32_t length)
+{
+    pcb_t *pcb = current_running;
+
+    length = PAGE_ALIGN(length);
+    if((addr & (PAGE_SIZE - 1)) || length == 0 || addr >= VM_SIZE || length > VM_SIZE - addr){
+        return -1;
+    }
+    if(vm_large_split(pcb, addr, addr + length) || vma_remove(pcb, addr, addr + length) < 0){
+        return -1;
+    }
+    vm_release_range(pcb, addr, addr + length);
+    return 0;
+}
+
+/* set the end of the heap, 0 just asks for it; the old end is returned if it cannot move */
+uint32_t do_brk(uint32_t addr)
+{
+    pcb_t *pcb = current_running;
+    uint32_t old_end = PAGE_ALIGN(pcb->brk);
+    uint32_t new_end = PAGE_ALIGN(addr);
+    vm_area_t *heap;
+
+    if(addr < USER_HEAP_BASE || addr > USER_MMAP_BASE){
+        return pcb->brk;
+    }
+
+    //the piece that ends at the break; munmap may have split the heap or taken its top away
+    heap = (old_end > USER_HEAP_BASE) ? vma_find(pcb, old_end - 1) : NULL;
+    if(heap != NULL && !(heap->flags & VMA_HEAP)){
+        heap = NULL;
+    }
+
+    if(new_end > old_end){
+        if(!vma_range_free(pcb, old_end, new_end)){
+            return pcb->brk;
+        }
+        if(heap != NULL){
+            heap->end = new_end;
+        }
+        else if(vma_insert(pcb, old_end, new_end, VMA_HEAP) < 0){
+            return pcb->brk;
+        }
+    }
+    else if(new_end < old_end){
+        if(vma_remove(pcb, new_end, old_end) < 0){
+            return pcb->brk;
+        }
+        vm_release_range(pcb, new_end, old_end);
+    }
+
+    pcb->brk = addr;
+    pcb->vma_enforced = TRUE;
+    return addr;
+}
+
+int do_map_large(uint32_t vaddr, uint32_t size)
+{
+    pcb_t *pcb = current_running;
+    int page_size;
+
+    if(size == 0 || vaddr >= VM_SIZE || size > VM_SIZE - vaddr || !vma_range_free(pcb, vaddr, vaddr + size)){
+        return -1;
+    }
+    if((page_size = vm_map_large(pcb, vaddr, size)) < 0){
+        return -1;
+    }
+    if(vma_insert(pcb, vaddr, vaddr + size, VMA_LARGE) < 0){
+        vm_release_range(pcb, vaddr, vaddr + size);
+        return -1;
+    }
+    pcb->vma_enforced = TRUE;
+    return page_size;
+}
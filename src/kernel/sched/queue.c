@@ -76,7 +76,7 @@ void clear_waiting_queue(queue_t *queue)
     while(!queue_is_empty(queue)){
         pcb_t *head = queue_dequeue(queue);
         head->status = TASK_READY;
-        queue_push(&ready_queue, head);
+        ready_queue_push(head);
     }
 }
 
@@ -133,3 +133,32 @@ void enqueue(queue_t *queue, void *item)
         queue->head = item;
     }
 }
+
+/* insert item before the first element e with item_comp(item, e) true,
+ * so a queue built only by queue_sort stays ordered (and FIFO among equals) */
+void queue_sort(queue_t *queue, void *item, item_comp_t item_comp)
+{
+    item_t *_item = (item_t *)item;
+    item_t *temp = (item_t *)queue->head;
+
+    while (temp != NULL && !item_comp(item, temp))
+    {
+        temp = (item_t *)temp->next;
+    }
+
+    if (temp == NULL)
+    {
+        queue_push(queue, item);
+    }
+    else if (temp == queue->head)
+    {
+        enqueue(queue, item);
+    }
+    else
+    {
+        _item->prev = temp->prev;
+        _item->next = temp;
+        ((item_t *)(temp->prev))->next = item;
+        temp->prev = item;
+    }
+}
@@ -5,33 +5,92 @@
 #include "queue.h"
 #include "screen.h"
 #include "mm.h"
+#include "vma.h"
+#include "trace.h"
 
 pcb_t pcb[NUM_MAX_TASK];
 
 /* global process id */
 pid_t process_id = 1;
 
-static uint32_t get_queue_head_daedline(queue_t *queue)
+/* scheduler statistics */
+uint32_t sched_switch_count = 0;
+uint32_t sched_switch_cycles = 0;
+
+/* schedules since the last priority boost */
+static uint32_t sched_boost_ticks = 0;
+
+static uint64_t get_queue_head_daedline(queue_t *queue)
 {
     return ((pcb_t *)(queue->head))->sleeping_deadline;
 }
 
-static int check_sleeping()
+static inline uint32_t count_leading_zeros(uint32_t x)
+{
+    uint32_t n;
+    __asm__ volatile(
+        ".set push\n\t"
+        ".set mips32\n\t"
+        "clz %0, %1\n\t"
+        ".set pop"
+        : "=r"(n) : "r"(x));
+    return n;
+}
+
+void ready_queue_push(pcb_t *item)
+{
+    if(item->priority < 0){
+        item->priority = 0;
+    }
+    else if(item->priority > MAX_PRIORITY){
+        item->priority = MAX_PRIORITY;
+    }
+    queue_push(&ready_queue[item->priority], item);
+    ready_queue_bitmap |= (1 << item->priority);
+    item->stamp_cycles = get_clock_cycles(); // start of its wait
+    if(item != current_running){
+        // another task is runnable now, it needs the periodic tick
+        timer_kick();
+    }
+}
+
+void ready_queue_remove(pcb_t *item)
 {
-    uint32_t current_time = get_timer();
-    if(queue_is_empty(&sleeping_queue)) return;
-    pcb_t* temp = (pcb_t *)(sleeping_queue.head);
+    queue_t *queue = &ready_queue[item->priority];
+    queue_remove(queue, item);
+    if(queue_is_empty(queue)){
+        ready_queue_bitmap &= ~(1 << item->priority);
+    }
+}
 
-    while(temp != NULL){
-        if(temp->sleeping_deadline < current_time){
-            queue_remove(&sleeping_queue, temp);            
-            temp->status = TASK_READY;
-            queue_push(&ready_queue, temp);
-            return 1;
+/* O(1): the highest non-empty level is given by clz of the bitmap */
+static pcb_t *ready_queue_pick()
+{
+    int level = 31 - count_leading_zeros(ready_queue_bitmap);
+    pcb_t *item = (pcb_t *)queue_dequeue(&ready_queue[level]);
+    if(queue_is_empty(&ready_queue[level])){
+        ready_queue_bitmap &= ~(1 << level);
+    }
+    return item;
+}
+
+/* move every ready task below INITIAL_PRIORITY back up, so nothing starves */
+static void priority_boost()
+{
+    int level;
+
+    if(++sched_boost_ticks < PRIORITY_BOOST_INTERVAL) return;
+    sched_boost_ticks = 0;
+
+    for(level = 0; level < INITIAL_PRIORITY; level++){
+        while(!queue_is_empty(&ready_queue[level])){
+            pcb_t *item = (pcb_t *)queue_dequeue(&ready_queue[level]);
+            item->priority = INITIAL_PRIORITY;
+            queue_push(&ready_queue[INITIAL_PRIORITY], item);
+            ready_queue_bitmap |= (1 << INITIAL_PRIORITY);
         }
-        temp = (pcb_t *)(temp->next);
+        ready_queue_bitmap &= ~(1 << level);
     }
-    return 0;
 }
 
 static int deadline_comp(void *item_1, void *item_2)
@@ -41,51 +100,112 @@ static int deadline_comp(void *item_1, void *item_2)
     return (_item_2->sleeping_deadline > _item_1->sleeping_deadline) ? 1 : 0 ;
 }
 
+/* sleeping_queue is kept sorted by sleeping_deadline, earliest first */
+void sleeping_queue_push(pcb_t *item, uint64_t deadline)
+{
+    item->sleeping_deadline = deadline;
+    queue_sort(&sleeping_queue, item, deadline_comp);
+    // the one-shot timer may have to fire earlier for this deadline
+    timer_kick();
+}
+
+/* wake every expired task, touching only the expired ones */
+static int check_sleeping()
+{
+    uint64_t current_time = get_clock_cycles();
+    int count = 0;
+
+    while(!queue_is_empty(&sleeping_queue) \
+        && get_queue_head_daedline(&sleeping_queue) <= current_time){
+        pcb_t *temp = (pcb_t *)queue_dequeue(&sleeping_queue);
+        temp->status = TASK_READY;
+        ready_queue_push(temp);
+        count++;
+    }
+    return count;
+}
+
 /* Change current_running to the next task */
 void scheduler(void)
 {
+    uint32_t begin_cycle = get_cp0_count();
+    uint64_t now = get_clock_cycles();
+    pid_t prev_pid = current_running->pid;
 
     current_running->cursor_x = screen_cursor_x;
     current_running->cursor_y = screen_cursor_y;
 
     if(current_running->status == TASK_RUNNING){
+        // only a timer preempts a running task, and only in user mode
+        current_running->user_cycles += now - current_running->stamp_cycles;
+        current_running->involuntary_switches++;
+    }
+    else{
+        // gave up the cpu inside a syscall
+        current_running->kernel_cycles += now - current_running->stamp_cycles;
+        current_running->voluntary_switches++;
+    }
+    current_running->stamp_cycles = now;
+
+    if(current_running->status == TASK_RUNNING){
+        // preempted with the time slice used up: demote one level
         current_running->status = TASK_READY;
+        if(current_running->priority > 0){
+            current_running->priority--;
+        }
         if(current_running->entry_point != 0){
             //initial pcb does not need to be pushed to ready_queue
-            queue_push(&ready_queue, current_running);           
+            ready_queue_push(current_running);
         }        
     }
 
+    priority_boost();
+
     check_sleeping(); // wake up sleeping processes
-    while (queue_is_empty(&ready_queue)){
-        if(queue_is_empty(&sleeping_queue)){
-            break;
-        }
-        check_sleeping();
-    }
 
-    pcb_t *_current_running = ((pcb_t *)(ready_queue.head));
-    while(_current_running != ((pcb_t *)(ready_queue.tail)) \
-        && _current_running->priority < ((pcb_t *)(_current_running->next))->priority){
-        _current_running = ((pcb_t *)(_current_running->next));
+    if(ready_queue_bitmap == 0){
+        // nothing to run, fall back to the idle context, which waits
+        // for the next interrupt (see _start)
+        current_running = &pcb_init;
+    }
+    else{
+        current_running = ready_queue_pick();
     }
-
-    current_running->priority--;
-    current_running = _current_running;        
-    queue_remove(&ready_queue, _current_running);
 
     current_running->status = TASK_RUNNING;
+    if(current_running != &pcb_init && current_running->stamp_cycles < now){
+        current_running->wait_cycles += now - current_running->stamp_cycles;
+    }
+    current_running->stamp_cycles = now;
+    current_running->switch_count++;
 
     screen_cursor_x = current_running->cursor_x;
     screen_cursor_y = current_running->cursor_y;
+
+    // entries of other tasks stay in the TLB, tagged with their own ASID
+    set_entryhi_asid(current_running->asid);
+
+    TRACE(TRACE_CLASS_SCHED, TRACE_SWITCH, prev_pid, current_running->pid);
+
+    sched_switch_count++;
+    sched_switch_cycles += get_cp0_count() - begin_cycle;
 }
 
 void do_sleep(uint32_t sleep_time)
 {
     if(current_running->status == TASK_RUNNING){
         current_running->status = TASK_SLEEPING;
-        current_running->sleeping_deadline = get_timer() + sleep_time;
-        queue_push(&sleeping_queue, current_running);      
+        sleeping_queue_push(current_running, \
+            get_clock_cycles() + (uint64_t)sleep_time * CYCLES_PER_TIMER_UNIT);
+    }
+        do_scheduler(); 
+}
+
+void do_usleep(uint32_t usec)
+{
+    if(current_running->status == TASK_RUNNING){
+        current_running->status = TASK_SLEEPING;
+        sleeping_queue_push(current_running, get_clock_cycles() + usec_to_cycles(usec));
     }
         do_scheduler(); 
 }
@@ -102,6 +222,7 @@ void do_block(queue_t *queue_ptr)
     // block the current_running task into the queue
     if(current_running->status == TASK_RUNNING){
         current_running->status = TASK_BLOCKED;
+        current_running->blocked_queue = queue_ptr;
         queue_push(queue_ptr, current_running);
     }
         do_scheduler();
@@ -120,7 +241,7 @@ void do_unblock_one(queue_t *queue_ptr)
         unblock_one_ptr = _unblock_one_ptr;
         queue_remove(queue_ptr, _unblock_one_ptr);
         unblock_one_ptr->status = TASK_READY;
-        queue_push(&ready_queue, unblock_one_ptr);
+        ready_queue_push(unblock_one_ptr);
     }
 }
 
@@ -134,7 +255,6 @@ void do_unblock_all(queue_t *queue)
 void do_ps()
 {
     int i = 1, j = 0;
-    pcb_t *head = ((pcb_t *)(ready_queue.head));
 
     ProcessShow[0].num = 0;
     ProcessShow[0].pid = current_running->pid;
@@ -167,78 +287,244 @@ void do_ps()
     ProcessShow[i].num = -1;
 }
 
-void do_spawn(task_info_t *task_info)
+void account_syscall_enter()
 {
-    //TO_IMPROVE
-    int i = 0;
+    uint64_t now = get_clock_cycles();
+    current_running->user_cycles += now - current_running->stamp_cycles;
+    current_running->stamp_cycles = now;
+}
 
-    PID++;
-    // flag_spawn = 1;
+void account_syscall_exit()
+{
+    uint64_t now = get_clock_cycles();
+    current_running->kernel_cycles += now - current_running->stamp_cycles;
+    current_running->stamp_cycles = now;
+}
+
+/* part * 100 / whole without 64-bit division */
+static uint32_t cycles_percent(uint64_t part, uint64_t whole)
+{
+    while(whole >> 32){
+        whole >>= 1;
+        part >>= 1;
+    }
+    if(whole == 0){
+        return 0;
+    }
+    part *= 100;
+    div64_32(&part, (uint32_t)whole);
+    return (uint32_t)part;
+}
 
-    while(pcb[i].status != TASK_EXITED){
-        i++;
-        if(i >= NUM_MAX_TASK){
-            //ERROR handle
-            return;
+static void fill_task_stat(task_stat_t *stat, int num, pcb_t *item, uint64_t now)
+{
+    uint64_t user = item->user_cycles;
+    uint64_t kernel = item->kernel_cycles;
+    uint64_t wait = item->wait_cycles;
+
+    // charge the slice in progress
+    if(item == current_running){
+        kernel += now - item->stamp_cycles;
+    }
+    stat->num = num;
+    stat->pid = item->pid;
+    stat->status = item->status;
+    stat->cpu_percent = cycles_percent(user + kernel, now - item->start_cycles);
+    stat->user_ms = cycles_to_msec(user);
+    stat->kernel_ms = cycles_to_msec(kernel);
+    stat->wait_ms = cycles_to_msec(wait);
+    stat->switch_count = item->switch_count;
+    stat->voluntary_switches = item->voluntary_switches;
+    stat->involuntary_switches = item->involuntary_switches;
+}
+
+void do_top()
+{
+    int i = 0, j;
+    uint64_t now = get_clock_cycles();
+
+    // pid 0 is the idle context, its cpu time is idle time
+    fill_task_stat(&TaskStat[i], i, &pcb_init, now);
+    i++;
+    for(j = 0; j < NUM_MAX_TASK; j++){
+        if(pcb[j].status != TASK_EXITED){
+            fill_task_stat(&TaskStat[i], i, &pcb[j], now);
+            i++;
+        }
+    }
+    TaskStat[i].num = -1;
+}
+
+/* free task slots, recently freed first: those already own a stack */
+static queue_t pcb_free_queue;
+
+/* pid -> pcb, chained through hash_next */
+static pcb_t *pid_hash[PID_HASH_SIZE];
+
+static void pid_hash_insert(pcb_t *item)
+{
+    pcb_t **bucket = &pid_hash[item->pid & (PID_HASH_SIZE - 1)];
+    item->hash_next = *bucket;
+    *bucket = item;
+}
+
+static void pid_hash_remove(pcb_t *item)
+{
+    pcb_t **link = &pid_hash[item->pid & (PID_HASH_SIZE - 1)];
+    while(*link != NULL){
+        if(*link == item){
+            *link = item->hash_next;
+            break;
+        }
+        link = &((*link)->hash_next);
+    }
+    item->hash_next = NULL;
+}
+
+pcb_t *get_pcb_by_pid(int pid)
+{
+    pcb_t *item = pid_hash[pid & (PID_HASH_SIZE - 1)];
+    while(item != NULL && item->pid != pid){
+        item = item->hash_next;
+    }
+    return item;
+}
+
+void init_pcb_table()
+{
+    int i;
+
+    queue_init(&pcb_free_queue);
+    for(i = 0; i < NUM_MAX_TASK; i++){
+        pcb[i].status = TASK_EXITED;
+        pcb[i].kernel_stack_top = 0;
+        pcb[i].user_stack_top = 0;
+        pcb[i].hash_next = NULL;
+        pcb[i].page_table_base_addr = 0;
+        pcb[i].asid = i + 1;
+        pcb[i].vma_list = NULL;     // free_page_table hands the slot back empty
+        pcb[i].vma_enforced = FALSE;
+        pcb[i].brk = USER_HEAP_BASE;
+        pcb[i].blocked_queue = NULL;
+        queue_push(&pcb_free_queue, &pcb[i]);
+    }
+    for(i = 0; i < PID_HASH_SIZE; i++){
+        pid_hash[i] = NULL;
+    }
+}
+
+/* take a free slot, the first use of a slot carves its kernel + user stack pair */
+static pcb_t *pcb_alloc()
+{
+    pcb_t *item;
+
+    if(queue_is_empty(&pcb_free_queue)){
+        return NULL;
+    }
+    item = (pcb_t *)queue_dequeue(&pcb_free_queue);
+
+    if(item->kernel_stack_top == 0){
+        //the page frames belong to page_map (kernel heap, page faults), keep stacks out;
+        //a slot is [STACK_TOP - STACK_SIZE, STACK_TOP + STACK_SIZE), the kernel stack grows down from STACK_TOP
+        if(STACK_TOP - STACK_SIZE < PAGE_FRAME_START + FRAME_SIZE && STACK_TOP + STACK_SIZE > PAGE_FRAME_START){
+            STACK_TOP = PAGE_FRAME_START + FRAME_SIZE + STACK_SIZE;
+        }
+        if(STACK_TOP + STACK_SIZE > STACK_MAX){
+            enqueue(&pcb_free_queue, item);
+            return NULL;
         }
+        item->kernel_stack_top = STACK_TOP;
+        item->user_stack_top = STACK_TOP + STACK_SIZE;
+        USER_STACK_TOP += VM_STACK_SIZE * 2;
+        STACK_TOP += STACK_SIZE*2;
+    }
+    return item;
+}
+
+/* the slot keeps its stacks for the next spawn */
+static void pcb_free(pcb_t *item)
+{
+    item->status = TASK_EXITED;
+    pid_hash_remove(item);
+    free_page_table(item);
+    enqueue(&pcb_free_queue, item);
+}
+
+int do_spawn(task_info_t *task_info)
+{
+    pcb_t *item = pcb_alloc();
+    int j = 0;
+
+    if(item == NULL){
+        //out of task slots or stack space
+        return -1;
     }
 
-    // set_entryhi_asid();
-    set_entryhi_asid(PID);
+    PID++;
 
-    queue_init(&(pcb[i].waiting_queue));
+    queue_init(&(item->waiting_queue));
+    item->blocked_queue = NULL;
 
-	bzero(&(pcb[i].kernel_context), sizeof(pcb[i].kernel_context));
-	bzero(&(pcb[i].user_context  ), sizeof(pcb[i].user_context  ));
-	int j = 0;
+	bzero(&(item->kernel_context), sizeof(item->kernel_context));
+	bzero(&(item->user_context  ), sizeof(item->user_context  ));
 	for(; j < LOCK_MAX_NUM; j++){
-		pcb[i].lock[j] = NULL;
-	}
-    pcb[i].kernel_context.regs[29] = STACK_TOP;
-	pcb[i].user_context.regs[29] = STACK_TOP + STACK_SIZE;
-    // pcb[i].user_context.regs[29] = USER_STACK_TOP + VM_STACK_SIZE;
-	pcb[i].kernel_context.regs[30] = STACK_TOP;
-	pcb[i].user_context.regs[30] = STACK_TOP + STACK_SIZE;
-	pcb[i].kernel_stack_top = STACK_TOP;
-	pcb[i].user_stack_top = STACK_TOP + STACK_SIZE;		
-
-    USER_STACK_TOP += VM_STACK_SIZE * 2;
-	STACK_TOP += STACK_SIZE*2;
-	if(STACK_TOP > STACK_MAX)
-	{
-		//TODO
+		item->lock[j] = NULL;
 	}
+    item->kernel_context.regs[29] = item->kernel_stack_top;
+	item->user_context.regs[29] = item->user_stack_top;
+    // item->user_context.regs[29] = USER_STACK_TOP + VM_STACK_SIZE;
+	item->kernel_context.regs[30] = item->kernel_stack_top;
+	item->user_context.regs[30] = item->user_stack_top;
 
-	pcb[i].prev = NULL;
-	pcb[i].next = NULL;
-	pcb[i].pid = PID;
-	pcb[i].type = task_info->type;
-	pcb[i].status = TASK_CREATED;
-	pcb[i].cursor_x = 0;
-	pcb[i].cursor_y = 0;
+	item->prev = NULL;
+	item->next = NULL;
+	item->pid = PID;
+	item->type = task_info->type;
+	item->status = TASK_CREATED;
+	item->cursor_x = 0;
+	item->cursor_y = 0;
 
-	pcb[i].entry_point = task_info->entry_point;
+	item->entry_point = task_info->entry_point;
 
-	pcb[i].kernel_context.regs[31] = (uint32_t)first_entry;
+	item->kernel_context.regs[31] = (uint32_t)first_entry;
 
-	pcb[i].kernel_context.cp0_status = CP0_STATUS_INIT;
-	pcb[i].user_context.cp0_status = CP0_STATUS_INIT;
+	item->kernel_context.cp0_status = CP0_STATUS_INIT;
+	item->user_context.cp0_status = CP0_STATUS_INIT;
 
-	pcb[i].kernel_context.cp0_epc = pcb[i].entry_point;
+	item->kernel_context.cp0_epc = item->entry_point;
 	//???
-	pcb[i].user_context.cp0_epc = pcb[i].entry_point;
+	item->user_context.cp0_epc = item->entry_point;
 	//cp0_epc add 4 automatically when encountering interrupt
 
-	pcb[i].mode = USER_MODE;
-	pcb[i].priority = INITIAL_PRIORITY;
-	pcb[i].wait_time = 0;
-	pcb[i].sleeping_deadline = 0;
-    pcb[i].lock_num = 0;
+	item->mode = USER_MODE;
+	item->priority = INITIAL_PRIORITY;
+	item->user_cycles = 0;
+	item->kernel_cycles = 0;
+	item->wait_cycles = 0;
+	item->start_cycles = get_clock_cycles();
+	item->stamp_cycles = item->start_cycles;
+	item->switch_count = 0;
+	item->voluntary_switches = 0;
+	item->involuntary_switches = 0;
+	item->sleeping_deadline = 0;
+    item->lock_num = 0;
+
+    pid_hash_insert(item);
+	ready_queue_push(item);
+
+    return PID;
+}
 
-    // PID++;
-	queue_push(&ready_queue,&pcb[i]); 
+/* spawn a task that starts out sharing the caller's user pages copy-on-write */
+int do_spawn_cow(task_info_t *task_info)
+{
+    int pid = do_spawn(task_info);
 
-    // flag_spawn = 0;
+    if(pid >= 0 && vm_share_cow(get_pcb_by_pid(pid), current_running) < 0){
+        do_kill(pid);
+        return -1;
+    }
+    return pid;
 }
 
 void do_exit()
@@ -253,10 +539,12 @@ void do_exit()
     while(!queue_is_empty(&(current_running->waiting_queue))){
         pcb_t *head = queue_dequeue(&(current_running->waiting_queue));
         head->status = TASK_READY;
-        queue_push(&ready_queue, head);
+        ready_queue_push(head);
     }
 
-    current_running->status = TASK_EXITED;
+    // nothing touches the slot or its stack until the next spawn,
+    // which cannot run before we are switched away
+    pcb_free(current_running);
     do_scheduler();
 }
 
@@ -267,59 +555,53 @@ int  do_getpid()
 
 void do_waitpid(int n)
 {
-    int i = 0;
-    while(pcb[i].pid != n){
-        i++;
-        if(i >= NUM_MAX_TASK){
-            //ERROR
-            return;
-        }
+    pcb_t *item = get_pcb_by_pid(n);
+    if(item == NULL){
+        //already exited or never existed
+        return;
     }
-    if(pcb[i].status != TASK_EXITED){
+    if(item->status != TASK_EXITED){
         current_running->status = TASK_BLOCKED;
-        queue_push(&(pcb[i].waiting_queue), current_running);
+        current_running->blocked_queue = &(item->waiting_queue);
+        queue_push(&(item->waiting_queue), current_running);
         do_scheduler();
     }
 }
 
 void do_kill(int n)
 {
-    int i = 0;
-    while(pcb[i].pid != n){
-        i++;
-        if(i >= NUM_MAX_TASK){
-            //ERROR
-            return;
-        }
+    pcb_t *item = get_pcb_by_pid(n);
+    if(item == NULL){
+        //ERROR
+        return;
     }
-    if(pcb[i].status != TASK_EXITED){
-        if(pcb[i].status == TASK_READY){
-            queue_remove(&ready_queue, &pcb[i]);
+    if(item->status != TASK_EXITED){
+        if(item->status == TASK_READY){
+            ready_queue_remove(item);
         }
-        else if(pcb[i].status == TASK_BLOCKED){
-            int k = 0;
-            for(;k<MAX_LOCK_NUM_TOTAL;k++){
-                if(check_in_queue(&(Lock[k]->mutex_lock_queue), &pcb[i])){
-                    queue_remove(&(Lock[k]->mutex_lock_queue), &pcb[i]);
-                }
+        else if(item->status == TASK_BLOCKED){
+            //pcb_free() reuses prev/next, the task must be off its wait queue first
+            if(item->blocked_queue != NULL && check_in_queue(item->blocked_queue, item)){
+                queue_remove(item->blocked_queue, item);
             }
         }
-        else if(pcb[i].status == TASK_SLEEPING){
-            queue_remove(&sleeping_queue, &pcb[i]);
+        else if(item->status == TASK_SLEEPING){
+            queue_remove(&sleeping_queue, item);
         }
-        else if(pcb[i].status == TASK_CREATED){     
-            queue_remove(&ready_queue, &pcb[i]);     
+        else if(item->status == TASK_CREATED){     
+            ready_queue_remove(item);     
         }
 
-        pcb[i].status = TASK_EXITED;
+        item->status = TASK_EXITED;
 
         int j = 0;
         for(;j<LOCK_MAX_NUM;j++){
-            if(pcb[i].lock[j] != 0){
-                do_mutex_lock_release(pcb[i].lock[j]);
+            if(item->lock[j] != 0){
+                do_mutex_lock_release(item->lock[j]);
             }
         }
-        clear_waiting_queue(&(pcb[i].waiting_queue));
+        clear_waiting_queue(&(item->waiting_queue));
+        pcb_free(item);
     }
 
     if(current_running->pid == n){
@@ -329,9 +611,6 @@ void do_kill(int n)
 
 uint32_t get_pcb_index(int pid)
 {
-    int i = 0;
-    while(i < NUM_MAX_TASK && pcb[i].pid != pid){
-        i++;
-    }
-    return i;
+    pcb_t *item = get_pcb_by_pid(pid);
+    return (item == NULL) ? NUM_MAX_TASK : (uint32_t)(item - pcb);
 }
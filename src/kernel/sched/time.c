@@ -1,19 +1,166 @@
 #include "time.h"
+#include "regs.h"
+#include "sched.h"
+#include "queue.h"
+#include "mac.h"
+#include "trace.h"
 
 // uint32_t time_elapsed = 0;
 extern uint32_t time_elapsed;
 
+/* CP0_COUNT increments per microsecond */
 static int MHZ = 300;
 
+uint32_t timer_irq_count = 0;
+
+/* monotonic clock: CP0_COUNT folded into 64 bits */
+static uint32_t clock_last_count = 0;
+static uint64_t clock_cycles = 0;
+
+/* clock cycles at which the one-shot in CP0_COMPARE fires */
+static uint64_t timer_expiry = 0;
+
+/* *n /= base, returns the remainder (no libgcc for 64-bit division) */
+uint32_t div64_32(uint64_t *n, uint32_t base)
+{
+    uint64_t rem = *n;
+    uint64_t b = base;
+    uint64_t res = 0, d = 1;
+    uint32_t high = rem >> 32;
+
+    if(high >= base){
+        high /= base;
+        res = (uint64_t)high << 32;
+        rem -= (uint64_t)(high * base) << 32;
+    }
+
+    while((int64_t)b > 0 && b < rem){
+        b = b + b;
+        d = d + d;
+    }
+
+    do{
+        if(rem >= b){
+            rem -= b;
+            res += d;
+        }
+        b >>= 1;
+        d >>= 1;
+    }while(d);
+
+    *n = res;
+    return rem;
+}
+
+/* must run at least once per 2^32 cycles, the timer interrupt sees to that */
+uint64_t get_clock_cycles()
+{
+    uint32_t cp0_status = get_cp0_status();
+    uint32_t now;
+    uint64_t cycles;
+
+    // user tasks read the clock too, keep the update atomic
+    set_cp0_status(cp0_status & 0xfffffffe);
+    now = get_cp0_count();
+    clock_cycles += (uint32_t)(now - clock_last_count);
+    clock_last_count = now;
+    cycles = clock_cycles;
+    set_cp0_status(cp0_status);
+
+    return cycles;
+}
+
+uint64_t get_time_ns()
+{
+    uint64_t ns = get_clock_cycles() * 1000;
+    div64_32(&ns, MHZ);
+    return ns;
+}
+
+uint32_t cycles_to_msec(uint64_t cycles)
+{
+    div64_32(&cycles, MHZ * 1000);
+    return (uint32_t)cycles;
+}
+
+uint64_t usec_to_cycles(uint32_t usec)
+{
+    return (uint64_t)usec * MHZ;
+}
+
 uint32_t get_ticks()
 {
-    return time_elapsed;
+    uint64_t ticks = get_clock_cycles();
+    div64_32(&ticks, TIMER_INTERVAL);
+    return (uint32_t)ticks * TIME_ELAPSED_PER_TICK;
 }
 
 uint32_t get_timer()
 {
     //return time_elapsed / (50);
-    return time_elapsed / (5000);
+    uint64_t units = get_clock_cycles();
+    div64_32(&units, CYCLES_PER_TIMER_UNIT);
+    return (uint32_t)units;
+}
+
+void do_clock_gettime(timespec_t *ts)
+{
+    uint64_t ns = get_time_ns();
+    ts->tv_nsec = div64_32(&ns, 1000000000);
+    ts->tv_sec = (uint32_t)ns;
+}
+
+/* cycles from now until the next timer interrupt is needed */
+static uint32_t timer_next_interval(uint64_t now)
+{
+    uint32_t interval = TIMER_MAX_IDLE_TICKS * TIMER_INTERVAL;
+
+    // someone else wants the cpu, or the mac driver needs polling
+    if(ready_queue_bitmap != 0 || !queue_is_empty(&recv_block_queue)){
+        interval = TIMER_INTERVAL;
+    }
+
+    if(!queue_is_empty(&sleeping_queue)){
+        uint64_t deadline = ((pcb_t *)(sleeping_queue.head))->sleeping_deadline;
+        if(deadline <= now){
+            interval = TIMER_MIN_INTERVAL;
+        }
+        else if(deadline - now < interval){
+            interval = (uint32_t)(deadline - now);
+        }
+    }
+
+    if(interval < TIMER_MIN_INTERVAL){
+        interval = TIMER_MIN_INTERVAL;
+    }
+    return interval;
+}
+
+static void timer_program(uint64_t now, uint32_t interval)
+{
+    timer_expiry = now + interval;
+    set_cp0_compare(clock_last_count + interval);
+}
+
+void timer_tick()
+{
+    uint64_t now = get_clock_cycles();
+
+    time_elapsed = get_ticks();
+    timer_irq_count++;
+    TRACE(TRACE_CLASS_IRQ, TRACE_IRQ, 7, current_running->user_context.cp0_epc);
+
+    timer_program(now, timer_next_interval(now));
+}
+
+void timer_kick()
+{
+    uint64_t now = get_clock_cycles();
+    uint32_t interval = timer_next_interval(now);
+
+    if(now + interval < timer_expiry){
+        timer_program(now, interval);
+    }
 }
 
 void latency(uint32_t time)
@@ -25,4 +172,4 @@ void latency(uint32_t time)
 
     };
     return;
-}
\ No newline at end of file
+}
@@ -3,18 +3,26 @@
 #include "common.h"
 #include "screen.h"
 #include "syscall.h"
+#include "trace.h"
 
 /* syscall function pointer */
 int (*syscall[NUM_SYSCALLS])();
 
+/* whitelisted non-blocking syscalls, dispatched by handle_syscall without a full context save */
+int (*syscall_fast[NUM_SYSCALLS])();
+uint32_t syscall_fast_enabled = 1;
+
 void system_call_helper(int fn, int arg1, int arg2, int arg3)
 {
     int ret_val = 0;
 
     current_running->mode = KERNEL_MODE;
+    account_syscall_enter();
+    TRACE(TRACE_CLASS_SYSCALL, TRACE_SYSCALL, fn, arg1);
 
     ret_val = syscall[fn] (arg1,arg2,arg3);
     
+    account_syscall_exit();
     current_running->mode = USER_MODE;
 
     current_running->user_context.regs[2] = ret_val;
@@ -27,11 +35,78 @@ void invalid_syscall(void)
     //TODO
 }
 
+int do_syscall_batch(syscall_ring_t *ring)
+{
+    int count = 0;
+
+    while(ring->head != ring->tail){
+        syscall_entry_t *entry = &ring->entries[ring->head & (SYSCALL_RING_SIZE - 1)];
+        if(entry->fn < 0 || entry->fn >= NUM_SYSCALLS || entry->fn == SYSCALL_BATCH){
+            entry->ret = -1;
+        }
+        else{
+            entry->ret = syscall[entry->fn](entry->arg1, entry->arg2, entry->arg3);
+        }
+        ring->head++;
+        count++;
+    }
+    return count;
+}
+
+int do_null_syscall()
+{
+    return 0;
+}
+
+void syscall_ring_init(syscall_ring_t *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+/* returns the queued entry, its ret is valid after sys_syscall_batch; NULL when full */
+syscall_entry_t *syscall_ring_push(syscall_ring_t *ring, int fn, int arg1, int arg2, int arg3)
+{
+    syscall_entry_t *entry;
+
+    if(ring->tail - ring->head >= SYSCALL_RING_SIZE){
+        return NULL;
+    }
+    entry = &ring->entries[ring->tail & (SYSCALL_RING_SIZE - 1)];
+    entry->fn = fn;
+    entry->arg1 = arg1;
+    entry->arg2 = arg2;
+    entry->arg3 = arg3;
+    entry->ret = 0;
+    ring->tail++;
+    return entry;
+}
+
+int sys_syscall_batch(syscall_ring_t *ring)
+{
+    return invoke_syscall(SYSCALL_BATCH, (int)ring, IGNORE, IGNORE);
+}
+
+void sys_null()
+{
+    invoke_syscall(SYSCALL_NULL, IGNORE, IGNORE, IGNORE);
+}
+
 void sys_sleep(uint32_t time)
 {
     invoke_syscall(SYSCALL_SLEEP, time, IGNORE, IGNORE);
 }
 
+void sys_usleep(uint32_t usec)
+{
+    invoke_syscall(SYSCALL_USLEEP, usec, IGNORE, IGNORE);
+}
+
+void sys_clock_gettime(timespec_t *ts)
+{
+    invoke_syscall(SYSCALL_CLOCK_GETTIME, (int)ts, IGNORE, IGNORE);
+}
+
 void sys_block(queue_t *queue)
 {
     invoke_syscall(SYSCALL_BLOCK, (int)queue, IGNORE, IGNORE);
@@ -138,6 +213,41 @@ void sys_spawn(task_info_t *task_info)
     invoke_syscall(SYSCALL_SPAWN, (int)task_info, IGNORE, IGNORE);
 }
 
+int sys_spawn_cow(task_info_t *task_info)
+{
+    return invoke_syscall(SYSCALL_SPAWN_COW, (int)task_info, IGNORE, IGNORE);
+}
+
+int sys_map_large(uint32_t vaddr, uint32_t size)
+{
+    return invoke_syscall(SYSCALL_MAP_LARGE, (int)vaddr, (int)size, IGNORE);
+}
+
+int sys_tlb_wire(uint32_t vaddr)
+{
+    return invoke_syscall(SYSCALL_TLB_WIRE, (int)vaddr, IGNORE, IGNORE);
+}
+
+int sys_tlb_unwire(uint32_t vaddr)
+{
+    return invoke_syscall(SYSCALL_TLB_UNWIRE, (int)vaddr, IGNORE, IGNORE);
+}
+
+uint32_t sys_mmap(uint32_t addr, uint32_t length)
+{
+    return (uint32_t)invoke_syscall(SYSCALL_MMAP, (int)addr, (int)length, IGNORE);
+}
+
+int sys_munmap(uint32_t addr, uint32_t length)
+{
+    return invoke_syscall(SYSCALL_MUNMAP, (int)addr, (int)length, IGNORE);
+}
+
+uint32_t sys_brk(uint32_t addr)
+{
+    return (uint32_t)invoke_syscall(SYSCALL_BRK, (int)addr, IGNORE, IGNORE);
+}
+
 void sys_exit()
 {
     invoke_syscall(SYSCALL_EXIT, IGNORE, IGNORE, IGNORE);
@@ -163,6 +273,11 @@ void sys_ps()
     invoke_syscall(SYSCALL_PS, IGNORE, IGNORE, IGNORE);
 }
 
+void sys_top()
+{
+    invoke_syscall(SYSCALL_TOP, IGNORE, IGNORE, IGNORE);
+}
+
 int sys_scanf(int *mem)
 {
     invoke_syscall(SYSCALL_SCANF, (int)mem, IGNORE, IGNORE);
@@ -201,7 +316,7 @@ void sys_net_fast_recv(uint32_t rd, uint32_t rd_phy, uint32_t daddr)
 
 int sys_fopen(char *name, uint32_t mode)
 {
-    invoke_syscall(SYSCALL_FS_OPEN, (int)name, (int)mode, IGNORE);
+    return invoke_syscall(SYSCALL_FS_OPEN, (int)name, (int)mode, IGNORE);
 }
 
 void sys_fwrite(int fd, char *content, int length)
@@ -234,6 +349,11 @@ void sys_statfs()
     invoke_syscall(SYSCALL_FS_STATFS, IGNORE, IGNORE, IGNORE);
 }
 
+void sys_sync()
+{
+    invoke_syscall(SYSCALL_FS_SYNC, IGNORE, IGNORE, IGNORE);
+}
+
 void sys_mkdir(char *name)
 {
     int mode = 0;
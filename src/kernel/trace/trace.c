@@ -0,0 +1,64 @@
+#include "trace.h"
+#include "sched.h"
+#include "time.h"
+
+/*
+ * in-memory trace ring. writers are kernel paths that already run with
+ * interrupts off, so taking a slot is a plain increment; the ring simply
+ * overwrites the oldest records. readers never block writers.
+ */
+
+trace_record_t trace_ring[TRACE_RING_SIZE];
+uint32_t trace_head = 0;
+uint32_t trace_enabled = 0;
+
+static const char *trace_event_names[TRACE_NUM_EVENTS] = {
+    "fault", "switch", "syscall", "irq"
+};
+
+void trace_record(uint32_t event, uint32_t arg0, uint32_t arg1)
+{
+    trace_record_t *rec = &trace_ring[trace_head++ & (TRACE_RING_SIZE - 1)];
+
+    rec->timestamp = get_cp0_count();
+    rec->event = event;
+    rec->pid = current_running->pid;
+    rec->arg0 = arg0;
+    rec->arg1 = arg1;
+}
+
+/* 
+ * copy the newest (up to max) records out, oldest first. records that were
+ * overwritten while we copied are dropped from the front. returns the count.
+ */
+int trace_snapshot(trace_record_t *out, int max)
+{
+    uint32_t head = trace_head;
+    uint32_t first = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+    uint32_t oldest_valid, i;
+    int n = 0, skip = 0;
+
+    if(head - first > max){
+        first = head - max;
+    }
+    for(i = first; i < head; i++){
+        out[n++] = trace_ring[i & (TRACE_RING_SIZE - 1)];
+    }
+
+    oldest_valid = trace_head - TRACE_RING_SIZE;
+    if(trace_head > TRACE_RING_SIZE && oldest_valid > first){
+        skip = oldest_valid - first;
+        if(skip > n){
+            skip = n;
+        }
+        for(i = skip; i < n; i++){
+            out[i - skip] = out[i];
+        }
+    }
+    return n - skip;
+}
+
+const char *trace_event_name(uint32_t event)
+{
+    return (event < TRACE_NUM_EVENTS) ? trace_event_names[event] : "?";
+}
@@ -38,4 +38,35 @@ int unset_bitmap(BitMap_t bitmap, unsigned int index) {
     bitmap[byte] &= (~(0x1 << offset));
     
     return 0;
-}
\ No newline at end of file
+}
+
+int find_zero_bitmap(BitMap_t bitmap, unsigned int start, unsigned int size) {
+    unsigned int index = start;
+
+    while (index < size) {
+        if ((index % 8) == 0 && bitmap[index / 8] == 0xff) {
+            index += 8;
+            continue;
+        }
+        if (!check_bitmap(bitmap, index)) {
+            return index;
+        }
+        index++;
+    }
+    return -1;
+}
+
+int find_zero_run_bitmap(BitMap_t bitmap, unsigned int start, unsigned int size, unsigned int len) {
+    int first = find_zero_bitmap(bitmap, start, size);
+    unsigned int run = 0;
+
+    while (first >= 0 && first + len <= size) {
+        for (run = 1; run < len && !check_bitmap(bitmap, first + run); run++)
+            ;
+        if (run == len) {
+            return first;
+        }
+        first = find_zero_bitmap(bitmap, first + run, size);
+    }
+    return -1;
+}
@@ -44,5 +44,20 @@ int set_bitmap(BitMap_t, unsigned int);
  */
 int unset_bitmap(BitMap_t, unsigned int);
 
+/*
+ * Find the first 0 bit at or after start in a bitmap of size bits,
+ * whole bytes of 1s are skipped
+ *
+ * Return: its index, -1 if there is none
+ */
+int find_zero_bitmap(BitMap_t, unsigned int start, unsigned int size);
+
+/*
+ * Find len consecutive 0 bits at or after start in a bitmap of size bits
+ *
+ * Return: index of the first one, -1 if there is no such run
+ */
+int find_zero_run_bitmap(BitMap_t, unsigned int start, unsigned int size, unsigned int len);
+
 #endif
 
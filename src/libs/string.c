@@ -9,8 +9,76 @@ int strlen(char *src)
 	return i;
 }
 
+/*
+ * the copy/fill loops below move 32-bit words, eight per iteration, once the
+ * destination is word aligned; only the head and the tail go byte by byte.
+ * 64-bit ld/sd are not used: the exception path saves 32-bit halves only, so
+ * the upper half of a register could be lost across an interrupt.
+ */
+#define WORD_SIZE 4
+#define WORD_MASK (WORD_SIZE - 1)
+/* unsigned long is pointer sized on the board and on the host (tools/string_bench.c) */
+#define WORD_OFFSET(p) ((unsigned long)(p) & WORD_MASK)
+
 void memcpy(uint8_t *dest, uint8_t *src, uint32_t len)
 {
+	uint32_t *d, *s;
+	uint32_t w0, w1, shift;
+
+	if (len < 4 * WORD_SIZE)
+	{
+		for (; len != 0; len--)
+		{
+			*dest++ = *src++;
+		}
+		return;
+	}
+
+	/* align the destination */
+	for (; WORD_OFFSET(dest) != 0; len--)
+	{
+		*dest++ = *src++;
+	}
+	d = (uint32_t *)dest;
+
+	if (WORD_OFFSET(src) == 0)
+	{
+		s = (uint32_t *)src;
+		for (; len >= 8 * WORD_SIZE; len -= 8 * WORD_SIZE)
+		{
+			d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = s[3];
+			d[4] = s[4]; d[5] = s[5]; d[6] = s[6]; d[7] = s[7];
+			d += 8;
+			s += 8;
+		}
+		for (; len >= WORD_SIZE; len -= WORD_SIZE)
+		{
+			*d++ = *s++;
+		}
+		src = (uint8_t *)s;
+	}
+	else
+	{
+		/*
+		 * source and destination disagree on alignment: read aligned source
+		 * words and merge neighbours (little endian). the extra word read
+		 * never leaves the aligned word that holds the last byte we need.
+		 */
+		shift = WORD_OFFSET(src) * 8;
+		s = (uint32_t *)(src - WORD_OFFSET(src));
+		w0 = *s++;
+		for (; len >= 2 * WORD_SIZE; len -= 2 * WORD_SIZE)
+		{
+			w1 = *s++;
+			d[0] = (w0 >> shift) | (w1 << (32 - shift));
+			w0 = *s++;
+			d[1] = (w1 >> shift) | (w0 << (32 - shift));
+			d += 2;
+		}
+		src = (uint8_t *)s - WORD_SIZE + shift / 8;
+	}
+
+	dest = (uint8_t *)d;
 	for (; len != 0; len--)
 	{
 		*dest++ = *src++;
@@ -20,6 +88,32 @@ void memcpy(uint8_t *dest, uint8_t *src, uint32_t len)
 void memset(void *dest, uint8_t val, uint32_t len)
 {
 	uint8_t *dst = (uint8_t *)dest;
+	uint32_t *d;
+	uint32_t word;
+
+	if (len >= 4 * WORD_SIZE)
+	{
+		for (; WORD_OFFSET(dst) != 0; len--)
+		{
+			*dst++ = val;
+		}
+
+		word = val;
+		word |= word << 8;
+		word |= word << 16;
+		d = (uint32_t *)dst;
+		for (; len >= 8 * WORD_SIZE; len -= 8 * WORD_SIZE)
+		{
+			d[0] = word; d[1] = word; d[2] = word; d[3] = word;
+			d[4] = word; d[5] = word; d[6] = word; d[7] = word;
+			d += 8;
+		}
+		for (; len >= WORD_SIZE; len -= WORD_SIZE)
+		{
+			*d++ = word;
+		}
+		dst = (uint8_t *)d;
+	}
 
 	for (; len != 0; len--)
 	{
@@ -40,6 +40,7 @@
 #include "test_project3/test3.h"
 #include "test_net/test5.h"
 #include "test_fs/test6.h"
+#include "test_bench/test_bench.h"
 
 extern void test_shell();
 
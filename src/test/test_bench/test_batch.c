@@ -0,0 +1,62 @@
+#include "sched.h"
+#include "stdio.h"
+#include "syscall.h"
+#include "time.h"
+#include "test_bench.h"
+
+#define BATCH_BENCH_CALLS SYSCALL_RING_SIZE
+
+static syscall_ring_t bench_ring;
+
+/* cycles for BATCH_BENCH_CALLS null syscalls, one trap each */
+static uint32_t single_calls_cycles(void)
+{
+    int i;
+    uint32_t begin = get_cp0_count();
+
+    for(i = 0; i < BATCH_BENCH_CALLS; i++){
+        sys_null();
+    }
+    return get_cp0_count() - begin;
+}
+
+/* cycles for the same calls queued in the ring and run by one trap */
+static uint32_t batch_calls_cycles(void)
+{
+    int i;
+    uint32_t begin = get_cp0_count();
+
+    for(i = 0; i < BATCH_BENCH_CALLS; i++){
+        syscall_ring_push(&bench_ring, SYSCALL_NULL, IGNORE, IGNORE, IGNORE);
+    }
+    sys_syscall_batch(&bench_ring);
+    return get_cp0_count() - begin;
+}
+
+void batch_bench_task(void)
+{
+    int print_location = 1;
+    uint32_t saved = syscall_fast_enabled;
+    uint32_t single_full, single_fast, batch;
+
+    syscall_ring_init(&bench_ring);
+
+    syscall_fast_enabled = 0;
+    single_full = single_calls_cycles();
+    syscall_fast_enabled = 1;
+    single_fast = single_calls_cycles();
+    syscall_fast_enabled = saved;
+    batch = batch_calls_cycles();
+
+    sys_move_cursor(1, print_location);
+    printf("[BATCH BENCH] %d null syscalls, single (full path): %d cycles    ",
+        BATCH_BENCH_CALLS, single_full);
+    sys_move_cursor(1, print_location + 1);
+    printf("[BATCH BENCH] %d null syscalls, single (fast path): %d cycles    ",
+        BATCH_BENCH_CALLS, single_fast);
+    sys_move_cursor(1, print_location + 2);
+    printf("[BATCH BENCH] %d null syscalls, one batch: %d cycles    ",
+        BATCH_BENCH_CALLS, batch);
+
+    sys_exit();
+}
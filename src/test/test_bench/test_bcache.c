@@ -0,0 +1,133 @@
+#include "stdio.h"
+#include "syscall.h"
+#include "fs.h"
+#include "bcache.h"
+#include "dcache.h"
+#include "test_bench.h"
+
+/* mkdir, touch, ls and rmdir of a few entries in the current directory, once straight to the card and once cached */
+#define BCACHE_BENCH_NODES 3
+
+static void fs_workload(char tag)
+{
+    char dir[] = "./bc?d?";
+    char file[] = "bc?f?";
+    char path[] = "./bc?f?";
+    int i;
+
+    dir[4] = file[2] = path[4] = tag;
+    for(i = 0; i < BCACHE_BENCH_NODES; i++){
+        dir[6] = file[4] = '0' + i;
+        sys_mkdir(dir);
+        sys_touch(file);
+    }
+    sys_ls();
+    // newest first, so the directory's entry count goes back down
+    for(i = BCACHE_BENCH_NODES - 1; i >= 0; i--){
+        path[6] = dir[6] = '0' + i;
+        sys_rmdir(path);
+        sys_rmdir(dir);
+    }
+}
+
+/*
+ * a new file written and read back sequentially, one whole buffer per call.
+ * it reaches past the direct blocks, so the reads also resolve indirect pointers.
+ */
+#define FILE_BENCH_CHUNKS 5
+static char file_data[FILE_WRITE_MAX_LENGTH];
+
+static int file_roundtrip(int *write_transfers, int *read_transfers)
+{
+    int fd, i, chunk, errors = 0;
+    int writes;
+
+    sys_touch("bcfile");
+    fd = sys_fopen("bcfile", O_RDWR);
+    writes = bcache_sd_write_count;
+    for(chunk = 0; chunk < FILE_BENCH_CHUNKS; chunk++){
+        for(i = 0; i < FILE_WRITE_MAX_LENGTH; i++){
+            file_data[i] = (char)(i * 7 + chunk + 1);
+        }
+        sys_fwrite(fd, file_data, FILE_WRITE_MAX_LENGTH);
+    }
+    sys_sync();
+    *write_transfers = bcache_sd_write_count - writes;
+    sys_fclose(fd);
+
+    fd = sys_fopen("bcfile", O_RDWR);
+    *read_transfers = bcache_sd_read_count;
+    for(chunk = 0; chunk < FILE_BENCH_CHUNKS; chunk++){
+        sys_fread(fd, file_data, FILE_WRITE_MAX_LENGTH);
+        for(i = 0; i < FILE_WRITE_MAX_LENGTH; i++){
+            errors += (file_data[i] != (char)(i * 7 + chunk + 1));
+        }
+    }
+    *read_transfers = bcache_sd_read_count - *read_transfers;
+    sys_fclose(fd);
+
+    sys_rmdir("./bcfile");
+    return errors;
+}
+
+/* the same file opened over and over, after the first time its name comes from the dcache */
+#define LOOKUP_BENCH_OPENS 20
+
+static void lookup_bench(int *sd_reads, int *hits)
+{
+    int i;
+
+    sys_touch("bclook");
+    *sd_reads = bcache_sd_read_count;
+    *hits = dcache_hit_count;
+    for(i = 0; i < LOOKUP_BENCH_OPENS; i++){
+        sys_fclose(sys_fopen("bclook", O_RDWR));
+    }
+    *sd_reads = bcache_sd_read_count - *sd_reads;
+    *hits = dcache_hit_count - *hits;
+    sys_rmdir("./bclook");
+}
+
+void bcache_bench_task(void)
+{
+    int print_location = 1;
+    uint32_t saved = bcache_enabled;
+    int reads, writes, direct_reads, direct_writes;
+    int file_errors, file_writes, file_reads;
+    int lookup_reads, lookup_hits;
+
+    sys_sync();
+    bcache_enabled = 0;
+    reads = bcache_sd_read_count;
+    writes = bcache_sd_write_count;
+    fs_workload('a');
+    direct_reads = bcache_sd_read_count - reads;
+    direct_writes = bcache_sd_write_count - writes;
+
+    bcache_enabled = 1;
+    reads = bcache_sd_read_count;
+    writes = bcache_sd_write_count;
+    fs_workload('b');
+    sys_sync();
+    reads = bcache_sd_read_count - reads;
+    writes = bcache_sd_write_count - writes;
+
+    file_errors = file_roundtrip(&file_writes, &file_reads);
+    lookup_bench(&lookup_reads, &lookup_hits);
+    bcache_enabled = saved;
+
+    sys_move_cursor(1, print_location);
+    printf("[BCACHE BENCH] %d x (mkdir + touch) + ls + rmdir, SD transfers read/written:    ",
+        BCACHE_BENCH_NODES);
+    sys_move_cursor(1, print_location + 1);
+    printf("uncached %d / %d, cached %d / %d (incl. sync), %d hits    ",
+        direct_reads, direct_writes, reads, writes, bcache_hit_count);
+    sys_move_cursor(1, print_location + 2);
+    printf("%dKB file in %d calls: write + sync %d transfers, read %d transfers, errors %d    ",
+        FILE_BENCH_CHUNKS * FILE_WRITE_MAX_LENGTH / 1024, FILE_BENCH_CHUNKS, file_writes, file_reads, file_errors);
+    sys_move_cursor(1, print_location + 3);
+    printf("%d x fopen of one name: %d SD transfers, %d dcache hits    ",
+        LOOKUP_BENCH_OPENS, lookup_reads, lookup_hits);
+
+    sys_exit();
+}
@@ -0,0 +1,29 @@
+#ifndef INCLUDE_TEST_BENCH_H_
+#define INCLUDE_TEST_BENCH_H_
+
+#include "type.h"
+
+//context switch latency with 1, 2, 4, 8 runnable tasks
+void sched_bench_task(void);
+
+//null syscall round trip, full vs fast entry path
+void syscall_bench_task(void);
+
+//N single syscalls vs one SYSCALL_BATCH of N
+void batch_bench_task(void);
+
+//memcpy/memset MB/s per size, byte loop as a baseline
+void string_bench_task(void);
+
+//TLB refills per second, C path vs refill vector; 2MB sweep, 4KB vs large pages; hot pair, random vs wired
+void tlb_bench_task(void);
+
+//3x FRAME_PAGES working set through swap, checked page by page
+void swap_stress_task(void);
+
+//zero page on first load, copy-on-write children from sys_spawn_cow
+void cow_bench_task(void);
+void mmap_bench_task(void);
+void bcache_bench_task(void);
+
+#endif
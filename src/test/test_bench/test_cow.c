@@ -0,0 +1,86 @@
+#include "sched.h"
+#include "stdio.h"
+#include "syscall.h"
+#include "mm.h"
+#include "test_bench.h"
+
+/* a parent region shared copy-on-write with COW_CHILDREN children, each of which dirties COW_DIRTY pages */
+#define COW_BASE 0x30000000
+#define COW_PAGES 256
+#define COW_CHILDREN 4
+#define COW_DIRTY 4
+
+static volatile int cow_child_errors;
+
+static volatile uint32_t *cow_page(int page)
+{
+    return (volatile uint32_t *)(COW_BASE + page * PAGE_SIZE);
+}
+
+static void cow_child_task(void)
+{
+    int page;
+
+    // loads only: every page still comes from the parent's frames
+    for(page = 0; page < COW_PAGES; page++){
+        if(*cow_page(page) != page){
+            cow_child_errors++;
+        }
+    }
+    // the first store to a shared page copies it
+    for(page = 0; page < COW_DIRTY; page++){
+        *cow_page(page) = ~page;
+        if(*cow_page(page) != ~page){
+            cow_child_errors++;
+        }
+    }
+    sys_exit();
+}
+
+static struct task_info cow_child_info = {"cow_child", (uint32_t)&cow_child_task, USER_PROCESS};
+
+void cow_bench_task(void)
+{
+    int print_location = 1;
+    int errors = 0, page, i;
+    int zero = page_zero_map_count, cow = page_cow_count;
+    int pid[COW_CHILDREN];
+    int zero_maps, zero_copies;
+
+    // first touch by a load maps the zero page, no frame yet
+    for(page = 0; page < COW_PAGES; page++){
+        errors += (*cow_page(page) != 0);
+    }
+    zero_maps = page_zero_map_count - zero;
+
+    // the first store gets a private frame
+    for(page = 0; page < COW_PAGES; page++){
+        *cow_page(page) = page;
+    }
+    zero_copies = page_cow_count - cow;
+
+    cow_child_errors = 0;
+    cow = page_cow_count;
+    for(i = 0; i < COW_CHILDREN; i++){
+        pid[i] = sys_spawn_cow(&cow_child_info);
+    }
+    for(i = 0; i < COW_CHILDREN; i++){
+        if(pid[i] > 0){
+            sys_waitpid(pid[i]);
+        }
+    }
+
+    // the children's stores must not show through
+    for(page = 0; page < COW_PAGES; page++){
+        errors += (*cow_page(page) != page);
+    }
+
+    sys_move_cursor(1, print_location);
+    printf("[COW BENCH] zero page: %d loads mapped, %d copied on store; errors %d    ",
+        zero_maps, zero_copies, errors + cow_child_errors);
+    sys_move_cursor(1, print_location + 1);
+    printf("%d children x %d pages shared, %d frames copied instead of %d    ",
+        COW_CHILDREN, COW_PAGES, page_cow_count - cow, COW_CHILDREN * COW_PAGES);
+
+    sys_exit();
+}
@@ -0,0 +1,100 @@
+#include "sched.h"
+#include "stdio.h"
+#include "syscall.h"
+#include "mm.h"
+#include "vma.h"
+#include "test_bench.h"
+
+/* an anonymous region and a heap, each touched page by page and given back */
+#define MMAP_BENCH_PAGES 256
+#define BRK_BENCH_PAGES 64
+
+static volatile int mmap_child_survived;
+
+static int touch_pages(uint32_t base, int npages)
+{
+    int errors = 0, page;
+    volatile uint32_t *p;
+
+    for(page = 0; page < npages; page++){
+        p = (volatile uint32_t *)(base + page * PAGE_SIZE);
+        errors += (*p != 0);
+        *p = page;
+    }
+    return errors;
+}
+
+/* a store outside every area has to end this task */
+static void mmap_child_task(void)
+{
+    uint32_t area = sys_mmap(0, PAGE_SIZE);
+
+    if(area != 0){
+        *(volatile uint32_t *)area = 1;
+        *(volatile uint32_t *)(USER_MMAP_END - PAGE_SIZE) = 1;
+    }
+    mmap_child_survived = 1;
+    sys_exit();
+}
+
+static struct task_info mmap_child_info = {"mmap_child", (uint32_t)&mmap_child_task, USER_PROCESS};
+
+void mmap_bench_task(void)
+{
+    int print_location = 1;
+    int errors = 0, pid;
+    uint32_t base, heap, free_before, free_touched, free_after;
+    uint32_t heap_touched, heap_after;
+
+    base = sys_mmap(0, MMAP_BENCH_PAGES * PAGE_SIZE);
+    if(base == 0){
+        sys_move_cursor(1, print_location);
+        printf("[MMAP BENCH] mmap of %d pages failed    ", MMAP_BENCH_PAGES);
+        sys_exit();
+    }
+
+    free_before = page_free_frames();
+    errors += touch_pages(base, MMAP_BENCH_PAGES);
+    free_touched = page_free_frames();
+    // unmapping the middle splits the area in two
+    errors += (sys_munmap(base + PAGE_SIZE, (MMAP_BENCH_PAGES - 2) * PAGE_SIZE) != 0);
+    errors += (*(volatile uint32_t *)base != 0);
+    errors += (sys_munmap(base, MMAP_BENCH_PAGES * PAGE_SIZE) != 0);
+    free_after = page_free_frames();
+
+    sys_move_cursor(1, print_location);
+    printf("[MMAP BENCH] %d pages: %d frames taken by touching, %d back after munmap    ",
+        MMAP_BENCH_PAGES, free_before - free_touched, free_after - free_touched);
+
+    heap = sys_brk(0);
+    errors += (sys_brk(heap + BRK_BENCH_PAGES * PAGE_SIZE) != heap + BRK_BENCH_PAGES * PAGE_SIZE);
+    free_before = page_free_frames();
+    errors += touch_pages(heap, BRK_BENCH_PAGES);
+    heap_touched = page_free_frames();
+    errors += (sys_brk(heap) != heap);
+    heap_after = page_free_frames();
+
+    // a heap with its first page and a middle page unmapped still moves both ways
+    errors += (sys_brk(heap + 3 * PAGE_SIZE) != heap + 3 * PAGE_SIZE);
+    errors += (sys_munmap(heap, PAGE_SIZE) != 0);
+    errors += (sys_brk(heap + 2 * PAGE_SIZE) != heap + 2 * PAGE_SIZE);
+    errors += (sys_brk(heap + 5 * PAGE_SIZE) != heap + 5 * PAGE_SIZE);
+    errors += touch_pages(heap + PAGE_SIZE, 4);
+    errors += (sys_munmap(heap + 3 * PAGE_SIZE, PAGE_SIZE) != 0);
+    errors += (sys_brk(heap + 2 * PAGE_SIZE) != heap + 2 * PAGE_SIZE);
+    errors += (*(volatile uint32_t *)(heap + PAGE_SIZE) != 0);
+    errors += (sys_brk(heap) != heap);
+
+    mmap_child_survived = 0;
+    pid = sys_spawn_cow(&mmap_child_info);
+    if(pid > 0){
+        sys_waitpid(pid);
+    }
+
+    sys_move_cursor(1, print_location + 1);
+    printf("[MMAP BENCH] brk +%d pages: %d frames, %d back on shrink; stray store %s; errors %d    ",
+        BRK_BENCH_PAGES, free_before - heap_touched, heap_after - heap_touched,
+        mmap_child_survived ? "NOT caught" : "killed", errors);
+
+    sys_exit();
+}
@@ -0,0 +1,64 @@
+#include "sched.h"
+#include "stdio.h"
+#include "syscall.h"
+#include "time.h"
+#include "test_bench.h"
+
+#define SCHED_BENCH_MAX_TASKS 8
+#define SCHED_BENCH_SWITCHES 200
+#define SCHED_BENCH_SLEEP 2
+#define SCHED_BENCH_USLEEP 200
+
+static int spin_pids[SCHED_BENCH_MAX_TASKS];
+
+static void sched_spin_task(void)
+{
+    while(1);
+}
+
+static struct task_info spin_task = {"sched_spin", (uint32_t)&sched_spin_task, USER_PROCESS};
+
+void sched_bench_task(void)
+{
+    int i, n, round = 0;
+    int spawned = 0;
+    uint32_t irq_begin;
+    timespec_t begin, end;
+    int print_location = 1;
+
+    for(n = 1; n <= SCHED_BENCH_MAX_TASKS; n *= 2, round++){
+        while(spawned < n){
+            sys_spawn(&spin_task);
+            spin_pids[spawned++] = PID;
+        }
+
+        sched_switch_count = 0;
+        sched_switch_cycles = 0;
+        while(sched_switch_count < SCHED_BENCH_SWITCHES);
+
+        sys_move_cursor(1, print_location + round);
+        printf("[SCHED BENCH] runnable: %d, switches: %d, avg cycles: %d    ",
+            n + 1, sched_switch_count, sched_switch_cycles / sched_switch_count);
+    }
+
+    for(i = 0; i < spawned; i++){
+        sys_kill(spin_pids[i]);
+    }
+
+    // with the spinners gone the ticks may be stretched while we sleep
+    irq_begin = timer_irq_count;
+    sys_sleep(SCHED_BENCH_SLEEP);
+    sys_move_cursor(1, print_location + round);
+    printf("[SCHED BENCH] timer interrupts during sleep(%d): %d    ",
+        SCHED_BENCH_SLEEP, timer_irq_count - irq_begin);
+
+    // sub-tick sleep precision against the monotonic clock
+    sys_clock_gettime(&begin);
+    sys_usleep(SCHED_BENCH_USLEEP);
+    sys_clock_gettime(&end);
+    sys_move_cursor(1, print_location + round + 1);
+    printf("[SCHED BENCH] usleep(%d) took %d us    ", SCHED_BENCH_USLEEP,
+        (end.tv_sec - begin.tv_sec) * 1000000 + end.tv_nsec / 1000 - begin.tv_nsec / 1000);
+
+    sys_exit();
+}
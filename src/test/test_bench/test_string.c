@@ -0,0 +1,70 @@
+#include "sched.h"
+#include "stdio.h"
+#include "syscall.h"
+#include "string.h"
+#include "time.h"
+#include "test_bench.h"
+
+#define STRING_BENCH_BYTES 0x10000
+#define STRING_BENCH_MAX_SIZE 4096
+
+static uint8_t bench_src[STRING_BENCH_MAX_SIZE + 4];
+static uint8_t bench_dst[STRING_BENCH_MAX_SIZE + 4];
+
+typedef void (*copy_fn_t)(uint8_t *, uint8_t *, uint32_t);
+
+/* the old byte loop, as a baseline */
+static void byte_memcpy(uint8_t *dest, uint8_t *src, uint32_t len)
+{
+    for(; len != 0; len--){
+        *dest++ = *src++;
+    }
+}
+
+/* bytes per microsecond == MB/s */
+static uint32_t to_mbps(uint32_t bytes, uint64_t ns)
+{
+    uint64_t scaled = (uint64_t)bytes * 1000;
+    if(ns == 0){
+        return 0;
+    }
+    div64_32(&scaled, (uint32_t)ns);
+    return (uint32_t)scaled;
+}
+
+static uint32_t copy_mbps(copy_fn_t fn, uint32_t size, int misalign)
+{
+    uint32_t rounds = STRING_BENCH_BYTES / size, i;
+    uint64_t begin = get_time_ns();
+
+    for(i = 0; i < rounds; i++){
+        fn(bench_dst, bench_src + misalign, size);
+    }
+    return to_mbps(rounds * size, get_time_ns() - begin);
+}
+
+static uint32_t set_mbps(uint32_t size)
+{
+    uint32_t rounds = STRING_BENCH_BYTES / size, i;
+    uint64_t begin = get_time_ns();
+
+    for(i = 0; i < rounds; i++){
+        memset(bench_dst, (uint8_t)i, size);
+    }
+    return to_mbps(rounds * size, get_time_ns() - begin);
+}
+
+void string_bench_task(void)
+{
+    int print_location = 1;
+    uint32_t size;
+
+    for(size = 16; size <= STRING_BENCH_MAX_SIZE; size *= 4){
+        sys_move_cursor(1, print_location++);
+        printf("[STRING BENCH] %d B: byte loop %d MB/s, memcpy %d MB/s, unaligned %d MB/s, memset %d MB/s    ",
+            size, copy_mbps(byte_memcpy, size, 0), copy_mbps(memcpy, size, 0),
+            copy_mbps(memcpy, size, 1), set_mbps(size));
+    }
+
+    sys_exit();
+}
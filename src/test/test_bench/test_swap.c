@@ -0,0 +1,76 @@
+#include "sched.h"
+#include "stdio.h"
+#include "syscall.h"
+#include "time.h"
+#include "mm.h"
+#include "test_bench.h"
+
+/* a working set of 3x the frames, so most of it lives in swap at any time */
+#define SWAP_STRESS_BASE 0x20000000
+#define SWAP_STRESS_PAGES (3 * FRAME_PAGES)
+#define SWAP_STRESS_STRIDE 97 // prime, so the second pass jumps around the set
+
+static uint32_t page_tag(int page, int pass)
+{
+    return (page << 8) ^ (pass * 0x9e3779b1);
+}
+
+static volatile uint32_t *page_word(int page, int word)
+{
+    return (volatile uint32_t *)(SWAP_STRESS_BASE + page * PAGE_SIZE) + word;
+}
+
+/* check what the last pass left in a page and stamp it for this one, returns 1 on a mismatch */
+static int check_and_stamp(int page, int prev_pass, int pass)
+{
+    int bad = 0;
+
+    if(prev_pass >= 0){
+        bad = *page_word(page, 0) != page_tag(page, prev_pass)
+           || *page_word(page, PAGE_SIZE / 4 - 1) != ~page_tag(page, prev_pass);
+    }
+    *page_word(page, 0) = page_tag(page, pass);
+    *page_word(page, PAGE_SIZE / 4 - 1) = ~page_tag(page, pass);
+    return bad;
+}
+
+void swap_stress_task(void)
+{
+    int print_location = 1;
+    int errors = 0, page, i;
+    int evict = page_evict_count, writeback = page_writeback_count;
+    int swapin = page_swapin_count, readahead = page_readahead_count;
+    int direct = page_direct_reclaim_count, background = swapd_reclaim_count;
+    uint64_t begin = get_time_ns();
+    uint64_t ms;
+
+    sys_move_cursor(1, print_location);
+    printf("[SWAP STRESS] %d pages over %d frames ...                        ",
+        SWAP_STRESS_PAGES, FRAME_PAGES);
+
+    // pass 0: sequential first touch, pass 1: strided, pass 2: sequential again
+    for(page = 0; page < SWAP_STRESS_PAGES; page++){
+        errors += check_and_stamp(page, -1, 0);
+    }
+    for(i = 0, page = 0; i < SWAP_STRESS_PAGES; i++){
+        errors += check_and_stamp(page, 0, 1);
+        page = (page + SWAP_STRESS_STRIDE) % SWAP_STRESS_PAGES;
+    }
+    for(page = 0; page < SWAP_STRESS_PAGES; page++){
+        errors += check_and_stamp(page, 1, 2);
+    }
+
+    ms = get_time_ns() - begin;
+    div64_32(&ms, 1000000);
+
+    sys_move_cursor(1, print_location);
+    printf("[SWAP STRESS] %d pages, %d errors, %d ms                          ",
+        SWAP_STRESS_PAGES, errors, (uint32_t)ms);
+    sys_move_cursor(1, print_location + 1);
+    printf("evict %d (written %d), swap-in %d (+%d read ahead), reclaim: %d direct / %d swapd    ",
+        page_evict_count - evict, page_writeback_count - writeback,
+        page_swapin_count - swapin, page_readahead_count - readahead,
+        page_direct_reclaim_count - direct, swapd_reclaim_count - background);
+
+    sys_exit();
+}
@@ -0,0 +1,38 @@
+#include "sched.h"
+#include "stdio.h"
+#include "syscall.h"
+#include "time.h"
+#include "test_bench.h"
+
+#define SYSCALL_BENCH_TIMES 1000
+
+/* average cycles of one null syscall round trip */
+static uint32_t null_syscall_cycles(void)
+{
+    int i;
+    uint32_t begin = get_cp0_count();
+
+    for(i = 0; i < SYSCALL_BENCH_TIMES; i++){
+        sys_null();
+    }
+    return (get_cp0_count() - begin) / SYSCALL_BENCH_TIMES;
+}
+
+void syscall_bench_task(void)
+{
+    int print_location = 1;
+    uint32_t saved = syscall_fast_enabled;
+    uint32_t slow, fast;
+
+    syscall_fast_enabled = 0;
+    slow = null_syscall_cycles();
+    syscall_fast_enabled = 1;
+    fast = null_syscall_cycles();
+    syscall_fast_enabled = saved;
+
+    sys_move_cursor(1, print_location);
+    printf("[SYSCALL BENCH] null syscall, full path: %d cycles, fast path: %d cycles    ",
+        slow, fast);
+
+    sys_exit();
+}
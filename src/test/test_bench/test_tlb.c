@@ -0,0 +1,128 @@
+#include "sched.h"
+#include "stdio.h"
+#include "syscall.h"
+#include "time.h"
+#include "mm.h"
+#include "test_bench.h"
+
+/* one touch per even page, so every touch needs its own TLB entry */
+#define TLB_BENCH_BASE 0x10000000
+#define TLB_BENCH_PAIRS 128
+#define TLB_BENCH_PASSES 20
+
+/* a 2MB region swept one touch per 8KB: 256 small entries, or one pair of 1MB pages */
+#define TLB_SMALL_BASE 0x40000000
+#define TLB_LARGE_BASE 0x40800000
+#define TLB_REGION_SIZE 0x200000
+
+/* a hot pair touched between every step of the small-page sweep */
+#define TLB_HOT_BASE 0x41000000
+
+static void touch_all(void)
+{
+    volatile uint32_t *p;
+    int i;
+
+    for(i = 0; i < TLB_BENCH_PAIRS; i++){
+        p = (volatile uint32_t *)(TLB_BENCH_BASE + i * 2 * PAGE_SIZE);
+        (void)*p;
+    }
+}
+
+/* refills per second and cycles per refill over TLB_BENCH_PASSES sweeps */
+static void measure(uint32_t *per_sec, uint32_t *cycles)
+{
+    int refills = tlb_refill_count, i;
+    uint32_t begin_cycle = get_cp0_count();
+    uint64_t begin = get_time_ns();
+    uint64_t ns;
+    uint64_t rate;
+
+    for(i = 0; i < TLB_BENCH_PASSES; i++){
+        touch_all();
+    }
+    ns = get_time_ns() - begin;
+    refills = tlb_refill_count - refills;
+
+    *cycles = (refills > 0) ? (get_cp0_count() - begin_cycle) / refills : 0;
+    rate = (uint64_t)refills * 1000000000;
+    if(ns != 0){
+        div64_32(&rate, (uint32_t)ns);
+    }
+    *per_sec = (uint32_t)rate;
+}
+
+static int sweep_refills(uint32_t base)
+{
+    int refills = tlb_refill_count, i;
+    uint32_t off;
+
+    for(i = 0; i < TLB_BENCH_PASSES; i++){
+        for(off = 0; off < TLB_REGION_SIZE; off += 2 * PAGE_SIZE){
+            (void)*(volatile uint32_t *)(base + off);
+        }
+    }
+    return tlb_refill_count - refills;
+}
+
+/* refills over a thrashing sweep that keeps coming back to the hot pair */
+static int hot_refills(void)
+{
+    int refills = tlb_refill_count, i;
+    uint32_t off;
+
+    for(i = 0; i < TLB_BENCH_PASSES; i++){
+        for(off = 0; off < TLB_REGION_SIZE; off += 2 * PAGE_SIZE){
+            (void)*(volatile uint32_t *)(TLB_SMALL_BASE + off);
+            *(volatile uint32_t *)TLB_HOT_BASE += 1;
+        }
+    }
+    return tlb_refill_count - refills;
+}
+
+void tlb_bench_task(void)
+{
+    int print_location = 1;
+    uint32_t saved = tlb_refill_fast_enabled;
+    uint32_t slow_rate, slow_cycles, fast_rate, fast_cycles;
+    int page_size, small_refills, large_refills, wired_slot;
+
+    // sys_map_large below turns on area checks for this task
+    sys_mmap(TLB_BENCH_BASE, TLB_BENCH_PAIRS * 2 * PAGE_SIZE);
+    sys_mmap(TLB_SMALL_BASE, TLB_REGION_SIZE);
+    sys_mmap(TLB_HOT_BASE, 2 * PAGE_SIZE);
+
+    // first touch allocates frames and tables, keep it out of the numbers
+    touch_all();
+
+    tlb_refill_fast_enabled = 0;
+    measure(&slow_rate, &slow_cycles);
+    tlb_refill_fast_enabled = 1;
+    measure(&fast_rate, &fast_cycles);
+    tlb_refill_fast_enabled = saved;
+
+    sys_move_cursor(1, print_location);
+    printf("[TLB BENCH] refills, C path: %d/s (%d cycles), refill vector: %d/s (%d cycles)    ",
+        slow_rate, slow_cycles, fast_rate, fast_cycles);
+
+    page_size = sys_map_large(TLB_LARGE_BASE, TLB_REGION_SIZE);
+    sweep_refills(TLB_SMALL_BASE);
+    small_refills = sweep_refills(TLB_SMALL_BASE);
+    large_refills = (page_size > 0) ? sweep_refills(TLB_LARGE_BASE) : -1;
+
+    sys_move_cursor(1, print_location + 1);
+    printf("[TLB BENCH] 2MB sweep x%d: 4KB pages %d refills, %dKB pages %d refills    ",
+        TLB_BENCH_PASSES, small_refills, page_size / 1024, large_refills);
+
+    hot_refills();
+    small_refills = hot_refills();
+    wired_slot = sys_tlb_wire(TLB_HOT_BASE);
+    large_refills = hot_refills();
+    sys_tlb_unwire(TLB_HOT_BASE);
+
+    sys_move_cursor(1, print_location + 2);
+    printf("[TLB BENCH] sweep + hot pair: %d refills, hot pair wired (slot %d): %d refills    ",
+        small_refills, wired_slot, large_refills);
+
+    sys_exit();
+}
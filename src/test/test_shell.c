@@ -37,6 +37,7 @@
 #include "sched.h"
 #include "queue.h"
 #include "fs.h"
+#include "trace.h"
 
 static void disable_interrupt()
 {
@@ -105,20 +106,33 @@ struct task_info task5_bonus = {"bonus",(uint32_t)&phy_regs_task_bonus, USER_PRO
 struct task_info task_fs = {"test_fs", (uint32_t)&test_fs, USER_PROCESS};
 // struct task_info task_fs_1 = {"test_fs_1", (uint32_t)&test_fs_1, USER_PROCESS};
 
-static uint32_t num_test_tasks = 24;
+struct task_info task_sched_bench = {"sched_bench", (uint32_t)&sched_bench_task, USER_PROCESS};
+struct task_info task_syscall_bench = {"syscall_bench", (uint32_t)&syscall_bench_task, USER_PROCESS};
+struct task_info task_batch_bench = {"batch_bench", (uint32_t)&batch_bench_task, USER_PROCESS};
+struct task_info task_string_bench = {"string_bench", (uint32_t)&string_bench_task, USER_PROCESS};
+struct task_info task_tlb_bench = {"tlb_bench", (uint32_t)&tlb_bench_task, USER_PROCESS};
+struct task_info task_swap_stress = {"swap_stress", (uint32_t)&swap_stress_task, USER_PROCESS};
+struct task_info task_cow_bench = {"cow_bench", (uint32_t)&cow_bench_task, USER_PROCESS};
+struct task_info task_mmap_bench = {"mmap_bench", (uint32_t)&mmap_bench_task, USER_PROCESS};
+struct task_info task_bcache_bench = {"bcache_bench", (uint32_t)&bcache_bench_task, USER_PROCESS};
 
-static struct task_info *test_tasks[24] = {&task1, &task2, &task3,
+static uint32_t num_test_tasks = 33;
+
+static struct task_info *test_tasks[33] = {&task1, &task2, &task3,
                                            &task4, &task5, &task6,
                                            &task7, &task8, &task9,
                                            &task10, &task11, &task12,
                                            &task13, &task14, &task15,
                                            &task16, &task17, &task18, &task19,
                                            &task5_1, &task5_2, &task5_3, &task5_bonus,
-                                           &task_fs
+                                           &task_fs,
+                                           &task_sched_bench, &task_syscall_bench, &task_batch_bench,
+                                           &task_string_bench, &task_tlb_bench, &task_swap_stress,
+                                           &task_cow_bench, &task_mmap_bench, &task_bcache_bench
                                            };
 
 #define INPUT_BUFFER_MAX_LENGTH 1000
-#define MAX_COMMAND 5
+#define MAX_COMMAND 7
 #define COMMAND_RECOGNIZED 1
 
 typedef struct InputBuffer {
@@ -133,12 +147,16 @@ typedef enum {
     COMMAND_PARSING_INVALID
 } PARSING_t;
 
-process_show_t ProcessShow[40];
+process_show_t ProcessShow[NUM_MAX_TASK + 2];
+task_stat_t TaskStat[NUM_MAX_TASK + 2];
+
+#define TRACE_DUMP_MAX 24
+static trace_record_t trace_dump[TRACE_DUMP_MAX];
 
 static char Buffer[INPUT_BUFFER_MAX_LENGTH];
 
 static InputBuffer_t inputBuffer;
-static char *Command[MAX_COMMAND] = {"ps", "clear", "spawn", "exec", "kill"};
+static char *Command[MAX_COMMAND] = {"ps", "top", "clear", "spawn", "exec", "kill", "trace"};
 
 static void init_InputBuffer(InputBuffer_t *p)
 {
@@ -151,7 +169,7 @@ static void init_InputBuffer(InputBuffer_t *p)
 static void init_ProcessShow()
 {
     int i = 0;
-    for(;i < 20; i++){
+    for(;i < NUM_MAX_TASK + 2; i++){
         ProcessShow[i].num = 0;
     }
 }
@@ -246,8 +264,10 @@ void test_shell()
                 /*
                 *COMMAND:
                 *   ps
+                *   top
                 *   clear
                 *   exec 0 ~ 23
+                *   trace | trace on | trace off
                 */
 
                 if(*(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer) == 'p' 
@@ -262,6 +282,48 @@ void test_shell()
                     }
                     printf("> root@UCAS_OS: ");
                 }
+                else if(*(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer) == 't' 
+                && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 1) == 'o'
+                && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 2) == 'p'){
+                    sys_top();
+                    printf("[TOP] PID CPU%% USER(ms) KERNEL(ms) WAIT(ms) SWITCH VOL INVOL\n");
+                    int j = 0;
+                    while(TaskStat[j].num >= 0){
+                        printf("  %d  %d%%  %d  %d  %d  %d  %d  %d  %s\n", TaskStat[j].pid, \
+                               TaskStat[j].cpu_percent, TaskStat[j].user_ms, TaskStat[j].kernel_ms, \
+                               TaskStat[j].wait_ms, TaskStat[j].switch_count, \
+                               TaskStat[j].voluntary_switches, TaskStat[j].involuntary_switches, \
+                               status_type_to_string(TaskStat[j].status));
+                        j++;
+                    }
+                    printf("> root@UCAS_OS: ");
+                }
+                else if(*(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer) == 't' 
+                && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 1) == 'r'
+                && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 2) == 'a'
+                && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 3) == 'c'
+                && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 4) == 'e'){
+                    char *arg = inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 6;
+                    if(*(arg - 1) == ' ' && arg[0] == 'o' && arg[1] == 'n'){
+                        trace_enabled = TRACE_CLASS_ALL;
+                        printf("[TRACE] on\n");
+                    }
+                    else if(*(arg - 1) == ' ' && arg[0] == 'o' && arg[1] == 'f' && arg[2] == 'f'){
+                        trace_enabled = 0;
+                        printf("[TRACE] off\n");
+                    }
+                    else{
+                        int n = trace_snapshot(trace_dump, TRACE_DUMP_MAX);
+                        int j = 0;
+                        printf("[TRACE] %d of %d records, cycles since the first\n", n, trace_head);
+                        for(; j < n; j++){
+                            printf("  +%u  %s  pid %d  %x %x\n", trace_dump[j].timestamp - trace_dump[0].timestamp, \
+                                   trace_event_name(trace_dump[j].event), trace_dump[j].pid, \
+                                   trace_dump[j].arg0, trace_dump[j].arg1);
+                        }
+                    }
+                    printf("> root@UCAS_OS: ");
+                }
                 else if(*(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer) == 'c' 
                 && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 1) == 'l'
                 && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 2) == 'e'
@@ -314,6 +376,7 @@ void test_shell()
                 *   rmdir ./1 | rmdir ./1/2
                 *   mkfs
                 *   statfs
+                *   sync
                 * 
                 * 
                 */
@@ -334,6 +397,13 @@ void test_shell()
                     sys_statfs();
                     printf("> root@UCAS_OS: ");
                 }
+                else if(*(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer) == 's' 
+                && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 1) == 'y'
+                && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 2) == 'n'
+                && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 3) == 'c'){
+                    sys_sync();
+                    printf("> root@UCAS_OS: ");
+                }
                 else if(*(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer) == 'c' 
                 && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 1) == 'd'
                 && *(inputBuffer_ptr->buffer + inputBuffer_ptr->pointer + 2) == ' '){
@@ -0,0 +1,124 @@
+/*
+ * host-side check + benchmark for libs/string.c
+ *   make string_bench && ./string_bench
+ * the kernel routines are pulled in under a kstr_ prefix so they do not
+ * clash with the host libc.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define strlen      kstr_strlen
+#define memcpy      kstr_memcpy
+#define memset      kstr_memset
+#define bzero       kstr_bzero
+#define strcmp      kstr_strcmp
+#define strcpy      kstr_strcpy
+#define strcat      kstr_strcat
+#define reverse     kstr_reverse
+#define itohex      kstr_itohex
+#define itoa        kstr_itoa
+#define atoi        kstr_atoi
+#define atoh        kstr_atoh
+#define is_hex_char kstr_is_hex_char
+#define htoi        kstr_htoi
+#define strpbrk     kstr_strpbrk
+#define strspn      kstr_strspn
+#define strchr      kstr_strchr
+#define strrchr     kstr_strrchr
+#define strtok      kstr_strtok
+#include "../libs/string.c"
+#undef memcpy
+#undef memset
+
+#define BUF_SIZE (8192 + 64)
+#define BENCH_BYTES (64 * 1024 * 1024)
+
+static unsigned char src_buf[BUF_SIZE];
+static unsigned char dst_buf[BUF_SIZE];
+static unsigned char ref_buf[BUF_SIZE];
+
+static void byte_memcpy(uint8_t *dest, uint8_t *src, uint32_t len)
+{
+    for (; len != 0; len--)
+        *dest++ = *src++;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check(void)
+{
+    int len, so, dof, i;
+
+    for (i = 0; i < BUF_SIZE; i++)
+        src_buf[i] = (unsigned char)(i * 7 + 3);
+
+    for (len = 0; len <= 300; len++)
+        for (so = 0; so < 4; so++)
+            for (dof = 0; dof < 4; dof++) {
+                memset(dst_buf, 0xee, BUF_SIZE);
+                memset(ref_buf, 0xee, BUF_SIZE);
+                kstr_memcpy(dst_buf + dof, src_buf + so, len);
+                memcpy(ref_buf + dof, src_buf + so, len);
+                if (memcmp(dst_buf, ref_buf, BUF_SIZE) != 0) {
+                    printf("memcpy mismatch len %d src+%d dst+%d\n", len, so, dof);
+                    return 1;
+                }
+
+                memset(ref_buf, 0xee, BUF_SIZE);
+                kstr_memset(dst_buf, 0xee, BUF_SIZE);
+                kstr_memset(dst_buf + dof, (uint8_t)len, len);
+                memset(ref_buf + dof, len, len);
+                if (memcmp(dst_buf, ref_buf, BUF_SIZE) != 0) {
+                    printf("memset mismatch len %d dst+%d\n", len, dof);
+                    return 1;
+                }
+            }
+    return 0;
+}
+
+typedef void (*copy_fn_t)(uint8_t *, uint8_t *, uint32_t);
+
+static double copy_mbps(copy_fn_t fn, uint32_t size, int misalign)
+{
+    long rounds = BENCH_BYTES / size, r;
+    double begin = now_sec();
+
+    for (r = 0; r < rounds; r++)
+        fn(dst_buf, src_buf + misalign, size);
+    return (double)rounds * size / (now_sec() - begin) / (1024 * 1024);
+}
+
+static double set_mbps(uint32_t size)
+{
+    long rounds = BENCH_BYTES / size, r;
+    double begin = now_sec();
+
+    for (r = 0; r < rounds; r++)
+        kstr_memset(dst_buf, (uint8_t)r, size);
+    return (double)rounds * size / (now_sec() - begin) / (1024 * 1024);
+}
+
+int main(void)
+{
+    uint32_t size;
+
+    if (check() != 0)
+        return 1;
+    printf("correctness: ok\n");
+
+    printf("%6s %12s %12s %12s %12s\n", "size", "byte MB/s", "memcpy MB/s", "unalig MB/s", "memset MB/s");
+    for (size = 16; size <= 8192; size *= 2) {
+        printf("%6u %12.1f %12.1f %12.1f %12.1f\n", size,
+               copy_mbps(byte_memcpy, size, 0),
+               copy_mbps(kstr_memcpy, size, 0),
+               copy_mbps(kstr_memcpy, size, 1),
+               set_mbps(size));
+    }
+    return 0;
+}